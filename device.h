@@ -23,16 +23,174 @@
 // Sampling & timer setup
 #define CONFIG_AFSK_DAC_SAMPLERATE 9600
 
+// Use the hand-written assembly version of the
+// demodulator filter and slicer (AFSK_demod.S)
+#ifndef CONFIG_AFSK_ASM_DEMOD
+    #define CONFIG_AFSK_ASM_DEMOD false
+#endif
+
+// Store a full cycle of ready-to-output DAC values
+// (512 bytes of flash) instead of folding a quarter
+// wave table (128 bytes) on every output sample
+#ifndef CONFIG_AFSK_DAC_TABLE
+    #define CONFIG_AFSK_DAC_TABLE true
+#endif
+
+// Output whole precomputed bits from a table of
+// waveform segments (1024 bytes of flash), so the
+// modulator only looks up a segment once per bit
+#ifndef CONFIG_AFSK_DAC_SEGMENTS
+    #define CONFIG_AFSK_DAC_SEGMENTS false
+#endif
+
+// Calculate CRCs with a 16 entry table (32 bytes of
+// flash) instead of the full 256 entry table (512)
+#ifndef CONFIG_CRC_NIBBLE_TABLE
+    #define CONFIG_CRC_NIBBLE_TABLE false
+#endif
+
 // Serial protocol settings
 #define SERIAL_PROTOCOL PROTOCOL_KISS
 // OR
 //#define SERIAL_PROTOCOL PROTOCOL_SIMPLE_SERIAL
 
+// Instrumentation settings. The ISR profiling build
+// is normally enabled from the Makefile "bench" target.
+#ifndef CONFIG_ISR_PROFILE
+    #define CONFIG_ISR_PROFILE false
+#endif
+
 // AX25 settings
-#if SERIAL_PROTOCOL == PROTOCOL_SIMPLE_SERIAL
+// Frames are limited to 330 bytes, the largest standard
+// AX.25 frame: a 256 byte information field and eight
+// digipeaters, including the CRC. Larger frames from the
+// host or the radio are dropped.
+#ifndef CUSTOM_FRAME_SIZE
     #define CUSTOM_FRAME_SIZE 330
 #endif
 
+// Number of frame sized blocks in the shared frame
+// pool. One block is kept for receiving from the radio,
+// and the rest are shared by serial input, the KISS
+// transmit queue and the digipeater. In KISS mode, the
+// third block lets the host send the next frame while
+// one is waiting for the channel.
+#ifndef CONFIG_FRAME_POOL_BLOCKS
+    #if SERIAL_PROTOCOL == PROTOCOL_KISS
+        #define CONFIG_FRAME_POOL_BLOCKS 3
+    #else
+        #define CONFIG_FRAME_POOL_BLOCKS 2
+    #endif
+#endif
+
+// Number of rules in the receive filter table. Each
+// rule takes 8 bytes of RAM and of EEPROM.
+#ifndef CONFIG_FILTER_RULES
+    #define CONFIG_FILTER_RULES 8
+#endif
+
+// Number of aliases the digipeater answers to, in
+// addition to its own callsign and WIDEn-N paths
+#ifndef CONFIG_DIGI_ALIASES
+    #define CONFIG_DIGI_ALIASES 4
+#endif
+
+// The digipeater never repeats the same UI frame twice
+// within CONFIG_DIGI_DUPE_TICKS sample clock ticks. It
+// remembers the last CONFIG_DIGI_DUPE_SIZE frames it
+// repeated, independently of the receive duplicate
+// check below, which can be turned off.
+#ifndef CONFIG_DIGI_DUPE_SIZE
+    #define CONFIG_DIGI_DUPE_SIZE 8
+#endif
+#ifndef CONFIG_DIGI_DUPE_TICKS
+    #define CONFIG_DIGI_DUPE_TICKS (30L * CONFIG_AFSK_DAC_SAMPLERATE)
+#endif
+
+// Channel access for digipeated frames in SimpleSerial
+// builds, which have no KISS transmit queue. The
+// persistence is out of 255, and the slot time is in
+// milliseconds.
+#ifndef CONFIG_DIGI_PERSISTENCE
+    #define CONFIG_DIGI_PERSISTENCE 63
+#endif
+#ifndef CONFIG_DIGI_SLOTTIME
+    #define CONFIG_DIGI_SLOTTIME 200
+#endif
+
+// Number of stations kept in the heard list. Each
+// entry takes 18 bytes of RAM.
+#ifndef CONFIG_HEARD_SIZE
+    #define CONFIG_HEARD_SIZE 8
+#endif
+
+// Received frames that repeat one of the last
+// CONFIG_DUPE_CACHE_SIZE frames within CONFIG_DUPE_TICKS
+// sample clock ticks (9600 per second) are dropped as
+// duplicates. Setting the time to 0 disables this.
+#ifndef CONFIG_DUPE_CACHE_SIZE
+    #define CONFIG_DUPE_CACHE_SIZE 8
+#endif
+#ifndef CONFIG_DUPE_TICKS
+    #define CONFIG_DUPE_TICKS (30L * CONFIG_AFSK_DAC_SAMPLERATE)
+#endif
+
+// Puts the CPU in idle sleep between sample interrupts
+// when the main loop has nothing to do. The time spent
+// sleeping is reported with the statistics.
+#ifndef CONFIG_IDLE_SLEEP
+    #define CONFIG_IDLE_SLEEP true
+#endif
+
+// Carrier detection. Besides decoded HDLC flags, the
+// modem looks at how regular the bit transitions of the
+// received signal are. A bit period is clean when it
+// has no transitions further than CONFIG_DCD_WINDOW PLL
+// steps (8 per sample) from where the bit clock expects
+// them, and the quality is the number of clean periods
+// among the last 32 bits. Noise stays below about 22
+// in test/dcd.c. Very quiet noise can score higher,
+// but is kept out by the level check.
+// Carrier is detected when the quality reaches the on
+// threshold while the average input level is at least
+// CONFIG_DCD_MIN_LEVEL (0-128), and is dropped again
+// when the quality falls below the off threshold.
+#ifndef CONFIG_DCD_WINDOW
+    #define CONFIG_DCD_WINDOW 8
+#endif
+#ifndef CONFIG_DCD_QUALITY_ON
+    #define CONFIG_DCD_QUALITY_ON 25
+#endif
+#ifndef CONFIG_DCD_QUALITY_OFF
+    #define CONFIG_DCD_QUALITY_OFF 16
+#endif
+#ifndef CONFIG_DCD_MIN_LEVEL
+    #define CONFIG_DCD_MIN_LEVEL 4
+#endif
+
+// Number of good frames the sample clock calibration
+// averages over before it trims the clock
+#ifndef CONFIG_CALIBRATION_FRAMES
+    #define CONFIG_CALIBRATION_FRAMES 32
+#endif
+
+// Channel load is the share of time the channel was
+// busy over the last CONFIG_LOAD_SECONDS seconds. With
+// adaptive CSMA, the persistence is lowered as the load
+// goes up, but not below CONFIG_LOAD_MIN_P.
+#ifndef CONFIG_LOAD_SECONDS
+    #define CONFIG_LOAD_SECONDS 10
+#endif
+#ifndef CONFIG_LOAD_MIN_P
+    #define CONFIG_LOAD_MIN_P 16
+#endif
+
+// Number of software timers for deferred tasks. Each
+// task that can be pending at the same time needs one.
+#ifndef CONFIG_SCHED_TIMERS
+    #define CONFIG_SCHED_TIMERS 4
+#endif
+
 // Serial settings
 #define BAUD 9600
 #define SERIAL_DEBUG false
@@ -1,8 +1,43 @@
 #include <string.h>
 #include "AFSK.h"
 #include "util/time.h"
+#include "util/stats.h"
+#include "util/CRC-CCIT.h"
+#include "protocol/AX25.h"
 
-extern volatile ticks_t _clock;
+#if CONFIG_ISR_PROFILE
+    #include "util/profile.h"
+#endif
+
+#if CONFIG_IDLE_SLEEP
+    #include <avr/sleep.h>
+#endif
+
+#if CONFIG_AFSK_ASM_DEMOD
+    #if FILTER_CUTOFF != 600
+        #error The assembly demodulator only implements the 600Hz filter!
+    #endif
+
+    // The assembly version expects these fields
+    // to be laid out right after each other
+    _Static_assert(offsetof(Afsk, iirY) - offsetof(Afsk, iirX) == 4, "Unexpected Afsk layout");
+    _Static_assert(offsetof(Afsk, sampledBits) - offsetof(Afsk, iirX) == 8, "Unexpected Afsk layout");
+
+    void afsk_demod_asm(int16_t *state, int8_t delayed, int8_t sample);
+#endif
+
+#if CONFIG_AFSK_DAC_SEGMENTS
+    // Returns the segment for the next bit, and moves
+    // the phase accumulator past it
+    inline static const uint8_t *segmentStart(Afsk *afsk) {
+        uint8_t tone = (afsk->phaseInc == MARK_INC) ? 0 : 1;
+        const uint8_t *segment = &seg_table[SEG_OFFSET(tone, afsk->phaseAcc)];
+        afsk->phaseAcc = (afsk->phaseAcc + SAMPLESPERBIT * afsk->phaseInc) % SIN_LEN;
+        return segment;
+    }
+#endif
+
+volatile ticks_t _clock;
 extern unsigned long custom_preamble;
 extern unsigned long custom_tail;
 
@@ -10,10 +45,6 @@ bool hw_afsk_dac_isr = false;
 bool hw_5v_ref = false;
 Afsk *AFSK_modem;
 
-// Forward declerations
-int afsk_getchar(FILE *strem);
-int afsk_putchar(char c, FILE *stream);
-
 void AFSK_hw_refDetect(void) {
     // This is manual for now
     #if ADC_REFERENCE == REF_5V
@@ -30,7 +61,7 @@ void AFSK_hw_init(void) {
 
     TCCR1A = 0;                                    
     TCCR1B = _BV(CS10) | _BV(WGM13) | _BV(WGM12);
-    ICR1 = (((CPU_FREQ+FREQUENCY_CORRECTION)) / 9600) - 1;
+    ICR1 = AFSK_TIMER_TOP;
 
     if (hw_5v_ref) {
         ADMUX = _BV(REFS0) | 0;
@@ -53,6 +84,35 @@ void AFSK_hw_init(void) {
     AFSK_DAC_INIT();
     LED_TX_INIT();
     LED_RX_INIT();
+
+    #if CONFIG_IDLE_SLEEP
+        set_sleep_mode(SLEEP_MODE_IDLE);
+    #endif
+}
+
+// Adjusts the sample timer period by a number of CPU
+// cycles. If the counter is already past the new end
+// of the period, it would run all the way to 0xFFFF
+// before wrapping, so it is restarted instead.
+void afsk_setClockTrim(int8_t trim) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        ICR1 = AFSK_TIMER_TOP + trim;
+        if (TCNT1 >= ICR1) TCNT1 = 0;
+    }
+}
+
+// Average sample level at the bits of a received
+// frame, 0-128
+uint8_t afsk_frameLevel(const HdlcFrameInfo *info) {
+    return info->bits ? info->levelSum / info->bits : 0;
+}
+
+// Average distance of the bit transitions of a received
+// frame from where the bit clock expected them, in
+// 1/256 of a bit. A clean signal gives a few units, and
+// frames with more than about 64 rarely decode.
+uint8_t afsk_frameJitter(const HdlcFrameInfo *info) {
+    return info->edges ? info->jitterSum * (256 / PHASE_MAX) / info->edges : 0;
 }
 
 void AFSK_init(Afsk *afsk) {
@@ -74,10 +134,6 @@ void AFSK_init(Afsk *afsk) {
     }
 
     AFSK_hw_init();
-
-    // Set up streams
-    FILE afsk_fd = FDEV_SETUP_STREAM(afsk_putchar, afsk_getchar, _FDEV_SETUP_RW);
-    afsk->fd = afsk_fd;
 }
 
 static void AFSK_txStart(Afsk *afsk) {
@@ -96,26 +152,17 @@ static void AFSK_txStart(Afsk *afsk) {
     }
 }
 
-int afsk_putchar(char c, FILE *stream) {
-    AFSK_txStart(AFSK_modem);
-    while(fifo_isfull_locked(&AFSK_modem->txFifo)) { /* Wait */ }
-    fifo_push_locked(&AFSK_modem->txFifo, c);
-    return 1;
-}
-
-int afsk_getchar(FILE *stream) {
-    if (fifo_isempty_locked(&AFSK_modem->rxFifo)) {
-        return EOF;
-    } else {
-        return fifo_pop_locked(&AFSK_modem->rxFifo);
-    }
+void afsk_write(Afsk *afsk, uint8_t c) {
+    AFSK_txStart(afsk);
+    while(fifo_isfull_locked(&afsk->txFifo)) { /* Wait */ }
+    fifo_push_locked(&afsk->txFifo, c);
 }
 
 void AFSK_transmit(char *buffer, size_t size) {
     fifo_flush(&AFSK_modem->txFifo);
     int i = 0;
     while (size--) {
-        afsk_putchar(buffer[i++], NULL);
+        afsk_write(AFSK_modem, buffer[i++]);
     }
 }
 
@@ -127,7 +174,7 @@ uint8_t AFSK_dac_isr(Afsk *afsk) {
                 afsk->sending = false;
                 afsk->sending_data = false;
                 LED_TX_OFF();
-                return 0;
+                return DAC_SAMPLE(0);
             } else {
                 if (!afsk->bitStuff) afsk->bitstuffCount = 0;
                 afsk->bitStuff = true;
@@ -148,7 +195,7 @@ uint8_t AFSK_dac_isr(Afsk *afsk) {
                         AFSK_DAC_IRQ_STOP();
                         afsk->sending = false;
                         LED_TX_OFF();
-                        return 0;
+                        return DAC_SAMPLE(0);
                     } else {
                         afsk->currentOutputByte = fifo_pop(&afsk->txFifo);
                     }
@@ -173,13 +220,20 @@ uint8_t AFSK_dac_isr(Afsk *afsk) {
         }
 
         afsk->sampleIndex = SAMPLESPERBIT;
+        #if CONFIG_AFSK_DAC_SEGMENTS
+            afsk->segment = segmentStart(afsk);
+        #endif
     }
 
-    afsk->phaseAcc += afsk->phaseInc;
-    afsk->phaseAcc %= SIN_LEN;
     afsk->sampleIndex--;
+    #if CONFIG_AFSK_DAC_SEGMENTS
+        return pgm_read_byte(afsk->segment++);
+    #else
+        afsk->phaseAcc += afsk->phaseInc;
+        afsk->phaseAcc %= SIN_LEN;
 
-    return sinSample(afsk->phaseAcc);
+        return dacSample(afsk->phaseAcc);
+    #endif
 }
 
 static bool hdlcParse(Hdlc *hdlc, bool bit, FIFOBuffer *fifo) {
@@ -198,9 +252,55 @@ static bool hdlcParse(Hdlc *hdlc, bool bit, FIFOBuffer *fifo) {
     // Now we'll look at the last 8 received bits, and
     // check if we have received a HDLC flag (01111110)
     if (hdlc->demodulatedBits == HDLC_FLAG) {
-        // If we have, check that our output buffer is
-        // not full.
-        if (!fifo_isfull(fifo)) {
+        stats.flags++;
+
+        // The CRC is calculated here as the bytes come
+        // in, so when a flag closes a frame, we already
+        // know if it is valid. If it is not, or bytes of
+        // it were lost, we put a HDLC_RESET in front of
+        // the flag. This makes the protocol layer drop
+        // the frame without checking it again.
+        bool invalid = hdlc->dropped;
+        bool good = false;
+        if (hdlc->frameLen >= AX25_MIN_FRAME_LEN) {
+            if (hdlc->crc != AX25_CRC_CORRECT) {
+                stats.crc_errors++;
+                invalid = true;
+            }
+            if (!invalid) {
+                hdlc->frame = hdlc->rx;
+                hdlc->frame.seq = ++hdlc->frameSeq;
+                good = true;
+            }
+        }
+
+        // A good frame's sequence number goes in front of
+        // its closing flag, escaped like a data byte. If
+        // it does not fit, the frame just goes without.
+        if (good && !fifo_isfull(fifo)) {
+            uint8_t seq = hdlc->frameSeq;
+            fifo_push(fifo, HDLC_SEQ);
+            if ((seq == HDLC_FLAG || seq == HDLC_RESET || seq == AX25_ESC || seq == HDLC_SEQ) && !fifo_isfull(fifo)) {
+                fifo_push(fifo, AX25_ESC);
+            }
+            if (!fifo_isfull(fifo)) fifo_push(fifo, seq);
+        }
+
+        // A frame starts at the first flag after the
+        // demodulator was out of sync, or at the flag
+        // that closed the frame before it. The counters
+        // start over at every flag.
+        ticks_t start = (!hdlc->receiving || hdlc->frameLen > 0) ? _clock : hdlc->rx.start;
+        memset(&hdlc->rx, 0, sizeof(hdlc->rx));
+        hdlc->rx.start = start;
+        if (invalid && !fifo_isfull(fifo)) {
+            fifo_push(fifo, HDLC_RESET);
+            hdlc->dropped = false;
+        }
+
+        // Then check that our output buffer is not
+        // full, and that a lost frame was marked.
+        if (!fifo_isfull(fifo) && !hdlc->dropped) {
             // If it isn't, we'll push the HDLC_FLAG into
             // the buffer and indicate that we are now
             // receiving data. For bling we also turn
@@ -227,6 +327,7 @@ static bool hdlcParse(Hdlc *hdlc, bool bit, FIFOBuffer *fifo) {
             hdlc->receiving = false;
             hdlc->dcd = false;
             hdlc->dcd_count = 0;
+            hdlc->dropped = true;
         }
 
         // Everytime we receive a HDLC_FLAG, we reset the
@@ -236,6 +337,8 @@ static bool hdlcParse(Hdlc *hdlc, bool bit, FIFOBuffer *fifo) {
         // of the received bytes.
         hdlc->currentByte = 0;
         hdlc->bitIndex = 0;
+        hdlc->frameLen = 0;
+        hdlc->crc = CRC_CCIT_INIT_VAL;
         return ret;
     }
 
@@ -299,6 +402,11 @@ static bool hdlcParse(Hdlc *hdlc, bool bit, FIFOBuffer *fifo) {
 
     // Increment the bitIndex and check if we have a complete byte
     if (++hdlc->bitIndex >= 8) {
+        // Count the first byte after a flag as the
+        // start of a new frame
+        if (hdlc->frameLen++ == 0) stats.frames_started++;
+        hdlc->crc = update_crc_ccit(hdlc->currentByte, hdlc->crc);
+
         // If we have a HDLC control character, put a AX.25 escape
         // in the received data. We know we need to do this,
         // because at this point we must have already seen a HDLC
@@ -310,7 +418,8 @@ static bool hdlcParse(Hdlc *hdlc, bool bit, FIFOBuffer *fifo) {
         // data.
         if ((hdlc->currentByte == HDLC_FLAG ||
              hdlc->currentByte == HDLC_RESET ||
-             hdlc->currentByte == AX25_ESC)) {
+             hdlc->currentByte == AX25_ESC ||
+             hdlc->currentByte == HDLC_SEQ)) {
             // We also need to check that our received data buffer
             // is not full before putting more data in
             if (!fifo_isfull(fifo)) {
@@ -322,6 +431,7 @@ static bool hdlcParse(Hdlc *hdlc, bool bit, FIFOBuffer *fifo) {
                 hdlc->dcd_count = 0;
                 LED_RX_OFF();
                 ret = false;
+                hdlc->dropped = true;
             }
         }
 
@@ -336,6 +446,7 @@ static bool hdlcParse(Hdlc *hdlc, bool bit, FIFOBuffer *fifo) {
             hdlc->dcd_count = 0;
             LED_RX_OFF();
             ret = false;
+            hdlc->dropped = true;
         }
 
         // Wipe received byte and reset bit index to 0
@@ -360,6 +471,16 @@ void AFSK_adc_isr(Afsk *afsk, int8_t currentSample) {
     // Chebyshev filter. The lowpass filtering serves
     // to "smooth out" the variations in the samples.
 
+    // Keep track of the peak input level, so the
+    // level of received frames can be reported
+    uint8_t level = (currentSample < 0) ? -currentSample : currentSample;
+    if (level > afsk->hdlc.rx.peak) afsk->hdlc.rx.peak = level;
+
+    #if CONFIG_AFSK_ASM_DEMOD
+    // The assembly version does the discrimination,
+    // filtering and bit slicing below in one go.
+    afsk_demod_asm(afsk->iirX, (int8_t)fifo_pop(&afsk->delayFifo), currentSample);
+    #else
     afsk->iirX[0] = afsk->iirX[1];
 
     #if FILTER_CUTOFF == 600
@@ -410,6 +531,7 @@ void AFSK_adc_isr(Afsk *afsk, int8_t currentSample) {
     afsk->sampledBits <<= 1;
     // And then add the sampled bit to our delay line
     afsk->sampledBits |= (afsk->iirY[1] > 0) ? 0 : 1;
+    #endif
 
     // Put the current raw sample in the delay FIFO
     fifo_push(&afsk->delayFifo, currentSample);
@@ -448,10 +570,28 @@ void AFSK_adc_isr(Afsk *afsk, int8_t currentSample) {
     // our timing to the transmitter, even if it's timing is
     // a little off compared to our own.
     if (SIGNAL_TRANSITIONED(afsk->sampledBits)) {
+        // While we are locked to a packet signal, the
+        // transitions land close to the middle of our
+        // window, but on noise or speech they land
+        // anywhere. This is used for carrier detection.
+        int8_t offset = afsk->currentPhase - PHASE_THRESHOLD;
+        if (offset >= -CONFIG_DCD_WINDOW && offset <= CONFIG_DCD_WINDOW) {
+            afsk->dcdEdges |= DCD_EDGE_ON;
+        } else {
+            afsk->dcdEdges |= DCD_EDGE_OFF;
+        }
+        afsk->hdlc.rx.edges++;
+        afsk->hdlc.rx.jitterSum += (offset < 0) ? -offset : offset;
+
+        // The net sum of these corrections over a frame
+        // tells how far our sample clock is off from the
+        // transmitters, which is used for calibration.
         if (afsk->currentPhase < PHASE_THRESHOLD) {
             afsk->currentPhase += PHASE_INC;
+            afsk->hdlc.rx.drift++;
         } else {
             afsk->currentPhase -= PHASE_INC;
+            afsk->hdlc.rx.drift--;
         }
         afsk->silentSamples = 0;
     } else {
@@ -472,6 +612,32 @@ void AFSK_adc_isr(Afsk *afsk, int8_t currentSample) {
         // bit in our stream of demodulated bits
         afsk->actualBits <<= 1;
 
+        // A bit period is clean if it had no transitions
+        // off the bit edge. A packet signal gives a run
+        // of clean bits, while noise rarely gives more
+        // than a few in a row. The count of clean bits
+        // among the last 32 is kept up to date as they
+        // are shifted through the history.
+        bool clean = !(afsk->dcdEdges & DCD_EDGE_OFF);
+        if (afsk->dcdHistory & 0x80000000UL) afsk->dcdQuality--;
+        afsk->dcdHistory <<= 1;
+        if (clean) {
+            afsk->dcdHistory |= 1;
+            afsk->dcdQuality++;
+        }
+        afsk->dcdEdges = 0;
+        afsk->hdlc.rx.bits++;
+        afsk->hdlc.rx.levelSum += level;
+
+        // The input level is averaged once per bit,
+        // and carrier is detected with some hysteresis
+        afsk->dcdLevel = afsk->dcdLevel - (afsk->dcdLevel >> 3) + (level >> 3);
+        if (afsk->dcdQuality >= CONFIG_DCD_QUALITY_ON && afsk->dcdLevel >= CONFIG_DCD_MIN_LEVEL) {
+            afsk->carrier = true;
+        } else if (afsk->dcdQuality < CONFIG_DCD_QUALITY_OFF || afsk->dcdLevel < CONFIG_DCD_MIN_LEVEL) {
+            afsk->carrier = false;
+        }
+
         // We determine the actual bit value by reading
         // the last 3 sampled bits. If there is two or
         // more 1's, we will assume that the transmitter
@@ -517,6 +683,7 @@ void AFSK_adc_isr(Afsk *afsk, int8_t currentSample) {
         // to check if an error occured.
 
         if (!hdlcParse(&afsk->hdlc, !TRANSITION_FOUND(afsk->actualBits), &afsk->rxFifo)) {
+            stats.rx_overruns++;
             afsk->status |= 1;
             if (fifo_isfull(&afsk->rxFifo)) {
                 fifo_flush(&afsk->rxFifo);
@@ -528,19 +695,98 @@ void AFSK_adc_isr(Afsk *afsk, int8_t currentSample) {
     if (afsk->silentSamples > DCD_TIMEOUT_SAMPLES) {
         afsk->silentSamples = 0;
         afsk->hdlc.dcd = false;
+        afsk->dcdHistory = 0;
+        afsk->dcdQuality = 0;
+        afsk->carrier = false;
         LED_RX_OFF();
     }
 
+    if (afsk->hdlc.dcd) stats.dcd_ticks++;
+    if (afsk->hdlc.dcd || afsk->carrier) afsk->busyTicks++;
+
 }
 
 
+// Number of CPU cycles since a Timer 1 reading. The
+// timer counts CPU cycles and restarts from zero every
+// sample period, so we account for one wrap-around.
+static inline uint16_t afsk_cyclesSince(uint16_t start) {
+    uint16_t now = TCNT1;
+    return (now >= start) ? now - start : now + ICR1 + 1 - start;
+}
+
+#if CONFIG_IDLE_SLEEP
+    static volatile uint16_t isrEntry;  // Timer 1 value when the last sample interrupt started
+    static uint16_t idleCycles;         // Sleep time not yet counted as a whole tick
+
+    // Sleeps until the next sample interrupt, and adds
+    // the time spent asleep to the idle statistics. This
+    // must be called with interrupts disabled, so the
+    // caller can check for work without a race, and it
+    // returns with interrupts enabled.
+    void afsk_sleep(void) {
+        uint16_t start = TCNT1;
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+
+        // The interrupt that woke us has just returned,
+        // and the next one is a whole sample period away,
+        // so the timestamp can be read without locking
+        uint16_t end = isrEntry;
+        idleCycles += (end >= start) ? end - start : end + ICR1 + 1 - start;
+        while (idleCycles > ICR1) {
+            idleCycles -= ICR1 + 1;
+            stats.idle_ticks++;
+        }
+    }
+#endif
+
 ISR(ADC_vect) {
+    uint16_t isrStart = TCNT1;
     TIFR1 = _BV(ICF1);
-    AFSK_adc_isr(AFSK_modem, ((int16_t)((ADC) >> 2) - 128));
+    #if CONFIG_IDLE_SLEEP
+        isrEntry = isrStart;
+    #endif
+
+    int8_t sample = ((int16_t)((ADC) >> 2) - 128);
+    #if CONFIG_ISR_PROFILE
+        // In the profiling build the demodulator is fed
+        // with our own modulator output while sending in
+        // full-duplex mode, so it has a real signal to
+        // decode when both run at the same time. In
+        // half-duplex mode it gets silence, like from a
+        // receiver that is muted while we transmit.
+        static int8_t loopback = 0;
+        if (hw_afsk_dac_isr) sample = AFSK_modem->fullDuplex ? loopback : 0;
+        uint16_t stepStart = TCNT1;
+    #endif
+
+    AFSK_adc_isr(AFSK_modem, sample);
+    #if CONFIG_ISR_PROFILE
+        profile_record(PROFILE_ADC, afsk_cyclesSince(stepStart));
+    #endif
+
     if (hw_afsk_dac_isr) {
-        DAC_PORT = (AFSK_dac_isr(AFSK_modem) & 0xF0) | _BV(3); 
+        #if CONFIG_ISR_PROFILE
+            stepStart = TCNT1;
+            uint8_t dacValue = AFSK_dac_isr(AFSK_modem);
+            profile_record(PROFILE_DAC, afsk_cyclesSince(stepStart));
+            loopback = (int16_t)dacValue - 128;
+            DAC_PORT = dacValue;
+        #else
+            DAC_PORT = AFSK_dac_isr(AFSK_modem);
+        #endif
+        stats.tx_ticks++;
     } else {
         DAC_PORT = 128;
     }
     ++_clock;
+
+    uint16_t isrTime = afsk_cyclesSince(isrStart);
+    if (isrTime > stats.isr_max) stats.isr_max = isrTime;
+    #if CONFIG_ISR_PROFILE
+        profile_record(PROFILE_ISR, isrTime);
+    #endif
 }
\ No newline at end of file
@@ -10,27 +10,6 @@
 #include "util/time.h"
 #include "protocol/HDLC.h"
 
-#define SIN_LEN 512
-static const uint8_t sin_table[] PROGMEM =
-{
-    128, 129, 131, 132, 134, 135, 137, 138, 140, 142, 143, 145, 146, 148, 149, 151,
-    152, 154, 155, 157, 158, 160, 162, 163, 165, 166, 167, 169, 170, 172, 173, 175,
-    176, 178, 179, 181, 182, 183, 185, 186, 188, 189, 190, 192, 193, 194, 196, 197,
-    198, 200, 201, 202, 203, 205, 206, 207, 208, 210, 211, 212, 213, 214, 215, 217,
-    218, 219, 220, 221, 222, 223, 224, 225, 226, 227, 228, 229, 230, 231, 232, 233,
-    234, 234, 235, 236, 237, 238, 238, 239, 240, 241, 241, 242, 243, 243, 244, 245,
-    245, 246, 246, 247, 248, 248, 249, 249, 250, 250, 250, 251, 251, 252, 252, 252,
-    253, 253, 253, 253, 254, 254, 254, 254, 254, 255, 255, 255, 255, 255, 255, 255,
-};
-
-inline static uint8_t sinSample(uint16_t i) {
-    uint16_t newI = i % (SIN_LEN/2);
-    newI = (newI >= (SIN_LEN/4)) ? (SIN_LEN/2 - newI -1) : newI;
-    uint8_t sine = pgm_read_byte(&sin_table[newI]);
-    return (i >= (SIN_LEN/2)) ? (255 - sine) : sine;
-}
-
-
 #define SWITCH_TONE(inc)  (((inc) == MARK_INC) ? SPACE_INC : MARK_INC)
 #define BITS_DIFFER(bits1, bits2) (((bits1)^(bits2)) & 0x01)
 #define DUAL_XOR(bits1, bits2) ((((bits1)^(bits2)) & 0x03) == 0x03)
@@ -55,6 +34,8 @@ inline static uint8_t sinSample(uint16_t i) {
 
 #define DCD_MIN_COUNT 6
 #define DCD_TIMEOUT_SAMPLES 96
+#define DCD_EDGE_ON  0x01                           // A transition where the bit clock expects one
+#define DCD_EDGE_OFF 0x02                           // A transition anywhere else
                        
 #if BITRATE == 960
     #define FILTER_CUTOFF 600
@@ -78,6 +59,31 @@ inline static uint8_t sinSample(uint16_t i) {
 #define PHASE_MAX    (SAMPLESPERBIT * PHASE_BITS)   // Resolution of our phase counter = 64
 #define PHASE_THRESHOLD  (PHASE_MAX / 2)            // Target transition point of our phase window
 
+// Timer 1 counts CPU cycles, and restarts every sample
+// period when it reaches this value. The clock trim
+// from the calibration is added to it.
+#define AFSK_TIMER_TOP (((CPU_FREQ+FREQUENCY_CORRECTION)) / 9600 - 1)
+
+// Receive metadata of a frame. The counters cover the
+// bits between the opening and the closing flag, and
+// the start is the first flag of the preamble, or the
+// closing flag of the frame before it. Each good frame
+// that is latched gets the next sequence number, which
+// is also passed to the protocol layer along with the
+// frame, so it can tell which frame the metadata
+// belongs to.
+typedef struct HdlcFrameInfo
+{
+    uint8_t seq;            // Sequence number of the frame
+    ticks_t start;          // Clock value at the opening flag
+    uint8_t peak;           // Largest sample level, 0-128
+    uint16_t bits;          // Bit periods, including stuffed bits
+    uint32_t levelSum;      // Sum of the sample levels at each bit
+    int16_t drift;          // Net PLL phase corrections
+    uint16_t edges;         // Bit transitions
+    uint32_t jitterSum;     // Sum of transition distances from the bit edge, in PLL steps
+} HdlcFrameInfo;
+
 typedef struct Hdlc
 {
     uint8_t demodulatedBits;
@@ -86,13 +92,16 @@ typedef struct Hdlc
     bool receiving;
     bool dcd;
     uint8_t dcd_count;
+    uint16_t frameLen;      // Bytes received since the last flag
+    uint16_t crc;           // Running CRC of the received bytes
+    bool dropped;           // Bytes were lost from the current frame
+    uint8_t frameSeq;       // Sequence number of the last good frame
+    HdlcFrameInfo rx;       // Metadata of the frame being received
+    volatile HdlcFrameInfo frame; // Metadata of the last good frame
 } Hdlc;
 
 typedef struct Afsk
 {
-    // Stream access to modem
-    FILE fd;
-
     // General values
     Hdlc hdlc;                              // We need a link control structure
     uint16_t preambleLength;                // Length of sync preamble
@@ -108,14 +117,25 @@ typedef struct Afsk
 
     uint16_t phaseAcc;                      // Phase accumulator
     uint16_t phaseInc;                      // Phase increment per sample
+    #if CONFIG_AFSK_DAC_SEGMENTS
+    const uint8_t *segment;                 // Next sample of the current bit
+    #endif
 
     uint8_t silentSamples;                 // How many samples were completely silent
 
+    uint8_t dcdEdges;                       // Transitions seen in the current bit, DCD_EDGE_ flags
+    uint32_t dcdHistory;                    // One bit per recent bit period, set if it was clean
+    volatile uint8_t dcdQuality;            // Clean bit periods in the history, 0-32
+    volatile uint8_t dcdLevel;              // Average input level, 0-128
+    volatile bool carrier;                  // Signal detected by quality and level
+    volatile uint16_t busyTicks;            // Sample ticks with a busy channel, wraps around
+
     FIFOBuffer txFifo;                      // FIFO for transmit data
     uint8_t txBuf[CONFIG_AFSK_TX_BUFLEN];   // Actual data storage for said FIFO
 
     volatile bool sending;                  // Set when modem is sending
     volatile bool sending_data;             // Set when modem is sending data
+    bool fullDuplex;                        // Keep demodulating while sending
 
     // Demodulation values
     FIFOBuffer delayFifo;                   // Delayed FIFO for frequency discrimination
@@ -136,8 +156,7 @@ typedef struct Afsk
 } Afsk;
 
 #define DIV_ROUND(dividend, divisor)  (((dividend) + (divisor) / 2) / (divisor))
-#define MARK_INC   (uint16_t)(DIV_ROUND(SIN_LEN * (uint32_t)MARK_FREQ, CONFIG_AFSK_DAC_SAMPLERATE))
-#define SPACE_INC  (uint16_t)(DIV_ROUND(SIN_LEN * (uint32_t)SPACE_FREQ, CONFIG_AFSK_DAC_SAMPLERATE))
+#include "AFSK_tables.h"
 
 #define AFSK_DAC_IRQ_START()   do { extern bool hw_afsk_dac_isr; hw_afsk_dac_isr = true; } while (0)
 #define AFSK_DAC_IRQ_STOP()    do { extern bool hw_afsk_dac_isr; hw_afsk_dac_isr = false; } while (0)
@@ -156,6 +175,25 @@ typedef struct Afsk
 #define LED_RX_ON()   do { LED_PORT |= _BV(2); } while (0)
 #define LED_RX_OFF()  do { LED_PORT &= ~_BV(2); } while (0)
 
+// Direct byte access to the modem for the protocol
+// layers. afsk_read returns EOF when there is no
+// received data waiting, and afsk_write blocks while
+// the transmit FIFO is full.
+static inline int afsk_read(Afsk *afsk) {
+    if (fifo_isempty_locked(&afsk->rxFifo)) return EOF;
+    return fifo_pop_locked(&afsk->rxFifo);
+}
+
+void afsk_write(Afsk *afsk, uint8_t c);
+
+#if CONFIG_IDLE_SLEEP
+    void afsk_sleep(void);
+#endif
+
+void afsk_setClockTrim(int8_t trim);
+uint8_t afsk_frameLevel(const HdlcFrameInfo *info);
+uint8_t afsk_frameJitter(const HdlcFrameInfo *info);
+
 void AFSK_init(Afsk *afsk);
 void AFSK_transmit(char *buffer, size_t size);
 void AFSK_poll(Afsk *afsk);
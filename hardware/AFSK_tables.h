@@ -0,0 +1,139 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+#ifndef AFSK_TABLES_H
+#define AFSK_TABLES_H
+
+// Output waveform tables of the modulator, generated at
+// compile time. Only PROGMEM, pgm_read_byte and _BV are
+// needed from avr-libc, and the tone frequencies and
+// SAMPLESPERBIT from AFSK.h, so the host checks in test/
+// can render the same tables.
+#include <stdint.h>
+
+#ifndef DIV_ROUND
+    #define DIV_ROUND(dividend, divisor)  (((dividend) + (divisor) / 2) / (divisor))
+#endif
+
+#define SIN_LEN 512
+
+// Quarter wave of the output sine, as 8-bit samples.
+// The tables below are generated from this at compile
+// time, by expanding X(index, value) for every entry.
+#define SIN_ROW(X, i, a, b, c, d, e, f, g, h, j, k, l, m, n, o, p, q) \
+    X((i)+0, a)  X((i)+1, b)  X((i)+2, c)  X((i)+3, d)  \
+    X((i)+4, e)  X((i)+5, f)  X((i)+6, g)  X((i)+7, h)  \
+    X((i)+8, j)  X((i)+9, k)  X((i)+10, l) X((i)+11, m) \
+    X((i)+12, n) X((i)+13, o) X((i)+14, p) X((i)+15, q)
+
+#define SIN_QUARTER_WAVE(X) \
+    SIN_ROW(X,   0, 128, 129, 131, 132, 134, 135, 137, 138, 140, 142, 143, 145, 146, 148, 149, 151) \
+    SIN_ROW(X,  16, 152, 154, 155, 157, 158, 160, 162, 163, 165, 166, 167, 169, 170, 172, 173, 175) \
+    SIN_ROW(X,  32, 176, 178, 179, 181, 182, 183, 185, 186, 188, 189, 190, 192, 193, 194, 196, 197) \
+    SIN_ROW(X,  48, 198, 200, 201, 202, 203, 205, 206, 207, 208, 210, 211, 212, 213, 214, 215, 217) \
+    SIN_ROW(X,  64, 218, 219, 220, 221, 222, 223, 224, 225, 226, 227, 228, 229, 230, 231, 232, 233) \
+    SIN_ROW(X,  80, 234, 234, 235, 236, 237, 238, 238, 239, 240, 241, 241, 242, 243, 243, 244, 245) \
+    SIN_ROW(X,  96, 245, 246, 246, 247, 248, 248, 249, 249, 250, 250, 250, 251, 251, 252, 252, 252) \
+    SIN_ROW(X, 112, 253, 253, 253, 253, 254, 254, 254, 254, 254, 255, 255, 255, 255, 255, 255, 255)
+
+// The DAC is a 4-bit resistor ladder on the upper half
+// of DAC_PORT, and bit 3 is always set. This converts
+// an 8-bit sample to the value written to the port.
+#define DAC_SAMPLE(s) (((s) & 0xF0) | _BV(3))
+
+#if CONFIG_AFSK_DAC_TABLE
+    // Full cycle of ready-to-output DAC port values,
+    // so each output sample is a single table lookup.
+    // The quarter wave is mirrored into all four
+    // quadrants with designated initializers.
+    #define DAC_QUADRANTS(i, v) \
+        [(i)] = DAC_SAMPLE(v), \
+        [SIN_LEN/2 - 1 - (i)] = DAC_SAMPLE(v), \
+        [SIN_LEN/2 + (i)] = DAC_SAMPLE(255 - (v)), \
+        [SIN_LEN - 1 - (i)] = DAC_SAMPLE(255 - (v)),
+
+    static const uint8_t dac_table[SIN_LEN] PROGMEM = {
+        SIN_QUARTER_WAVE(DAC_QUADRANTS)
+    };
+
+    inline static uint8_t dacSample(uint16_t i) {
+        return pgm_read_byte(&dac_table[i & (SIN_LEN - 1)]);
+    }
+#else
+    // Only the quarter wave is stored, and it is folded
+    // into the full cycle for every sample. This saves
+    // 384 bytes of flash over the full DAC table.
+    #define SIN_QUARTER(i, v) [(i)] = (v),
+
+    static const uint8_t sin_table[SIN_LEN/4] PROGMEM = {
+        SIN_QUARTER_WAVE(SIN_QUARTER)
+    };
+
+    inline static uint8_t sinSample(uint16_t i) {
+        uint16_t newI = i % (SIN_LEN/2);
+        newI = (newI >= (SIN_LEN/4)) ? (SIN_LEN/2 - newI -1) : newI;
+        uint8_t sine = pgm_read_byte(&sin_table[newI]);
+        return (i >= (SIN_LEN/2)) ? (255 - sine) : sine;
+    }
+
+    inline static uint8_t dacSample(uint16_t i) {
+        return DAC_SAMPLE(sinSample(i));
+    }
+#endif
+
+#define MARK_INC   (uint16_t)(DIV_ROUND(SIN_LEN * (uint32_t)MARK_FREQ, CONFIG_AFSK_DAC_SAMPLERATE))
+#define SPACE_INC  (uint16_t)(DIV_ROUND(SIN_LEN * (uint32_t)SPACE_FREQ, CONFIG_AFSK_DAC_SAMPLERATE))
+
+#if CONFIG_AFSK_DAC_SEGMENTS
+    #if SAMPLESPERBIT != 8
+        #error Waveform segments are only implemented for 8 samples per bit!
+    #endif
+
+    // Every bit advances the phase by SAMPLESPERBIT
+    // times one of the tone increments, so a bit can
+    // only ever start on a multiple of this quantum.
+    // The output for one bit is then fully determined
+    // by the tone and the starting phase bucket.
+    #define SEG_QUANTUM 8
+    #define SEG_BUCKETS (SIN_LEN / SEG_QUANTUM)
+    #define SEG_SIZE    (2 * SEG_BUCKETS * SAMPLESPERBIT)
+
+    _Static_assert((SAMPLESPERBIT * MARK_INC) % SEG_QUANTUM == 0, "Mark tone does not fit segment quantum");
+    _Static_assert((SAMPLESPERBIT * SPACE_INC) % SEG_QUANTUM == 0, "Space tone does not fit segment quantum");
+
+    // The segment table is generated from the same
+    // quarter wave as the sine tables. Each sine table
+    // index is visited once, and written to every slot
+    // (tone, bucket, sample) that outputs it. For the
+    // samples where no bucket starts on the quantum,
+    // the value goes to a scratch byte at the end.
+    #define SEG_START(n, inc, k) (((n) - (k) * (inc)) & (SIN_LEN - 1))
+    #define SEG_SLOT(n, inc, tone, k) \
+        ((SEG_START(n, inc, k) % SEG_QUANTUM) ? SEG_SIZE : \
+        (((tone) * SEG_BUCKETS + SEG_START(n, inc, k) / SEG_QUANTUM) * SAMPLESPERBIT + (k) - 1))
+    #define SEG_SAMPLE(n, v, inc, tone, k) [SEG_SLOT(n, inc, tone, k)] = DAC_SAMPLE(v),
+    #define SEG_TONE(n, v, inc, tone) \
+        SEG_SAMPLE(n, v, inc, tone, 1) SEG_SAMPLE(n, v, inc, tone, 2) \
+        SEG_SAMPLE(n, v, inc, tone, 3) SEG_SAMPLE(n, v, inc, tone, 4) \
+        SEG_SAMPLE(n, v, inc, tone, 5) SEG_SAMPLE(n, v, inc, tone, 6) \
+        SEG_SAMPLE(n, v, inc, tone, 7) SEG_SAMPLE(n, v, inc, tone, 8)
+    #define SEG_INDEX(n, v) SEG_TONE(n, v, MARK_INC, 0) SEG_TONE(n, v, SPACE_INC, 1)
+    #define SEG_QUADRANTS(i, v) \
+        SEG_INDEX((i), v) \
+        SEG_INDEX(SIN_LEN/2 - 1 - (i), v) \
+        SEG_INDEX(SIN_LEN/2 + (i), 255 - (v)) \
+        SEG_INDEX(SIN_LEN - 1 - (i), 255 - (v))
+
+    static const uint8_t seg_table[SEG_SIZE + 1] PROGMEM = {
+        SIN_QUARTER_WAVE(SEG_QUADRANTS)
+    };
+
+    // Offset of the segment for a bit of the given tone,
+    // 0 for mark and 1 for space, that starts at phase
+    #define SEG_OFFSET(tone, phase) ((((tone) * SEG_BUCKETS) + (phase) / SEG_QUANTUM) * SAMPLESPERBIT)
+#endif
+
+#endif
@@ -0,0 +1,70 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+#include <avr/eeprom.h>
+#include "Calibration.h"
+#include "AFSK.h"
+#include "util/settings.h"
+
+Calibration calibration;
+
+#define NV_MAGIC_BYTE 0x43
+
+// Applies the trim stored in EEPROM, if there is one
+void calibration_init(void) {
+    if (settings_valid() && eeprom_read_byte((void*)&nv.calibration.magic) == NV_MAGIC_BYTE) {
+        calibration.trim = eeprom_read_byte((void*)&nv.calibration.trim);
+        afsk_setClockTrim(calibration.trim);
+    }
+}
+
+void calibration_start(void) {
+    calibration.frames = 0;
+    calibration.drift = 0;
+    calibration.bits = 0;
+    calibration.active = true;
+}
+
+void calibration_stop(void) {
+    calibration.active = false;
+}
+
+void calibration_setTrim(int8_t trim) {
+    calibration.trim = trim;
+    afsk_setClockTrim(trim);
+    settings_stamp();
+    eeprom_update_byte((void*)&nv.calibration.trim, trim);
+    eeprom_update_byte((void*)&nv.calibration.magic, NV_MAGIC_BYTE);
+}
+
+// Adds a good frame of len bytes, including the CRC, to
+// the measurement. The drift is the net number of PLL
+// corrections the demodulator made while receiving it.
+void calibration_frame(int16_t drift, size_t len) {
+    if (!calibration.active) return;
+
+    // The corrections were counted from the opening
+    // flag up to the closing one
+    calibration.drift += drift;
+    calibration.bits += (len + 1) * 8;
+    if (++calibration.frames < CONFIG_CALIBRATION_FRAMES) return;
+
+    // If the PLL had to add phase, the transmitters
+    // bits went by in fewer samples than expected, so
+    // our sample clock is slow and the period should be
+    // shorter, and the other way around. Each bit is
+    // PHASE_MAX steps of the PLL.
+    int32_t num = -(int32_t)(AFSK_TIMER_TOP + 1 + calibration.trim) * calibration.drift * PHASE_INC;
+    int32_t den = (int32_t)calibration.bits * PHASE_MAX;
+    int32_t step = (num + ((num < 0) ? -den : den) / 2) / den;
+
+    int32_t trim = calibration.trim + step;
+    if (trim > INT8_MAX) trim = INT8_MAX;
+    if (trim < INT8_MIN) trim = INT8_MIN;
+
+    calibration.active = false;
+    calibration_setTrim(trim);
+}
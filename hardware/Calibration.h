@@ -0,0 +1,48 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+#ifndef HARDWARE_CALIBRATION_H
+#define HARDWARE_CALIBRATION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "device.h"
+
+// Sample clock calibration. Boards with a ceramic
+// resonator instead of a crystal can be off by several
+// tenths of a percent, which the demodulator PLL has to
+// make up for on every frame, and which also shifts the
+// tones we transmit.
+//
+// While calibration runs, the net PLL correction of
+// every good frame is collected. Averaged over frames
+// from many stations, it shows how much faster or
+// slower our sample clock runs than theirs. After
+// CONFIG_CALIBRATION_FRAMES frames, the sample timer
+// period is trimmed to match, and the trim is stored in
+// EEPROM, so it is applied at every startup. One step of
+// the trim is one CPU cycle of the sample period, about
+// 600 ppm at 16 MHz, so running the calibration again
+// after a trim only changes it if the clock is still
+// off by at least half a step.
+typedef struct Calibration {
+    bool active;            // Collecting frames
+    uint8_t frames;         // Frames collected so far
+    int8_t trim;            // Sample period adjustment in CPU cycles
+    int32_t drift;          // Net PLL corrections of the collected frames
+    uint32_t bits;          // Bits in the collected frames
+} Calibration;
+
+extern Calibration calibration;
+
+void calibration_init(void);
+void calibration_start(void);
+void calibration_stop(void);
+void calibration_frame(int16_t drift, size_t len);
+void calibration_setTrim(int8_t trim);
+
+#endif
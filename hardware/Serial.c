@@ -33,8 +33,7 @@ bool serial_available(uint8_t index) {
 
 
 int uart0_putchar(char c, FILE *stream) {
-    loop_until_bit_is_set(UCSR0A, UDRE0);
-    UDR0 = c;
+    serial_write(c);
     return 1;
 }
 
@@ -11,6 +11,18 @@ typedef struct Serial {
     FILE uart0;
 } Serial;
 
+// Direct output to the UART. The protocol layers write
+// through these, and the uart0 stream is only kept for
+// printf-style console output.
+static inline void serial_write(uint8_t c) {
+    loop_until_bit_is_set(UCSR0A, UDRE0);
+    UDR0 = c;
+}
+
+static inline void serial_writeSpan(const uint8_t *buf, size_t len) {
+    while (len--) serial_write(*buf++);
+}
+
 void serial_init(Serial *serial);
 bool serial_available(uint8_t index);
 int uart0_putchar(char c, FILE *stream);
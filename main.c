@@ -12,7 +12,12 @@
 #include "util/time.h"
 #include "hardware/AFSK.h"
 #include "hardware/Serial.h"
+#include "hardware/Calibration.h"
 #include "protocol/AX25.h"
+#include "util/pool.h"
+#include "util/sched.h"
+#include "protocol/Digi.h"
+#include "protocol/Load.h"
 
 #if SERIAL_PROTOCOL == PROTOCOL_KISS
     #include "protocol/KISS.h"
@@ -22,6 +27,15 @@
     #include "protocol/SimpleSerial.h"
 #endif
 
+#if CONFIG_ISR_PROFILE
+    #include <stdlib.h>
+    #include <avr/sleep.h>
+    #include <avr/interrupt.h>
+    #include "util/profile.h"
+    #include "util/stats.h"
+    #include "protocol/HDLC.h"
+#endif
+
 Serial serial;
 Afsk modem;
 AX25Ctx AX25;
@@ -33,7 +47,7 @@ AX25Ctx AX25;
 #endif
 
 #if SERIAL_PROTOCOL == PROTOCOL_SIMPLE_SERIAL
-    static uint8_t serialBuffer[AX25_MAX_FRAME_LEN+1];
+    static uint8_t *serialBuffer;   // Pool block holding the current command
     static int sbyte;
     static size_t serialLen = 0;
     static bool sertx = false;
@@ -47,14 +61,16 @@ void init(void) {
     sei();
 
     AFSK_init(&modem);
-    ax25_init(&AX25, &modem, &modem.fd, ax25_callback);
+    calibration_init();
+    load_init(&modem);
+    ax25_init(&AX25, &modem, ax25_callback);
 
     serial_init(&serial);    
     stdout = &serial.uart0;
     stdin  = &serial.uart0;
 
     #if SERIAL_PROTOCOL == PROTOCOL_KISS
-        kiss_init(&AX25, &modem, &serial);
+        kiss_init(&AX25, &modem);
     #endif
 
     #if SERIAL_PROTOCOL == PROTOCOL_SIMPLE_SERIAL
@@ -62,26 +78,221 @@ void init(void) {
     #endif
 }
 
+// Sleeps until the next sample interrupt when there is
+// no received data to process and no serial input. The
+// UART has no receive interrupt, but it buffers two
+// bytes and a byte takes several sample periods to
+// arrive, so it is still read in time.
+static void idle(void) {
+    #if CONFIG_IDLE_SLEEP
+        cli();
+        if (fifo_isempty(&modem.rxFifo) && !serial_available(0)) {
+            afsk_sleep();
+        }
+        sei();
+    #endif
+}
+
+#if CONFIG_ISR_PROFILE
+    static uint8_t *bench_putCall(uint8_t *ptr, const char *call, uint8_t ssid) {
+        for (uint8_t i = 0; i < 6; i++) *ptr++ = call[i] << 1;
+        *ptr++ = ssid;
+        return ptr;
+    }
+
+    #define BENCH_FWD_LEN  60
+    #define BENCH_FWD_RUNS 16
+
+    #if SERIAL_PROTOCOL == PROTOCOL_KISS
+        static void bench_hook(struct AX25Ctx *ctx) { }
+    #else
+        static void bench_hook(struct AX25Msg *msg) { }
+    #endif
+
+    // Timer 0 counts CPU cycles divided by 64 while a
+    // benchmark runs, and its overflow interrupt counts
+    // the overflows, so runs longer than 256 timer steps
+    // are measured correctly. The sample interrupt is
+    // masked instead of all interrupts, and the clock
+    // stands still while timing.
+    static volatile uint16_t benchOverflows;
+
+    ISR(TIMER0_OVF_vect) {
+        benchOverflows++;
+    }
+
+    static void bench_start(void) {
+        ADCSRA &= ~_BV(ADIE);
+        benchOverflows = 0;
+        TCCR0A = 0;
+        TCNT0 = 0;
+        TIFR0 = _BV(TOV0);
+        TIMSK0 = _BV(TOIE0);
+        TCCR0B = _BV(CS01) | _BV(CS00);
+    }
+
+    // Stops the timer and returns the CPU cycles since
+    // bench_start, including an overflow that happened
+    // too late for its interrupt to run
+    static uint32_t bench_stop(void) {
+        TCCR0B = 0;
+        uint32_t steps;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            steps = ((uint32_t)benchOverflows << 8) + TCNT0;
+            if (TIFR0 & _BV(TOV0)) steps += 256;
+        }
+        TIMSK0 = 0;
+        TIFR0 = _BV(TOV0);
+        ADCSRA |= _BV(ADIE);
+        return steps * 64;
+    }
+
+    // Times the receive forwarding path, from the modem
+    // FIFO through the AX.25 layer to the frame callback,
+    // and returns the average CPU cycles per byte. With
+    // toHost set, the real callback is used, so the time
+    // includes encoding the frame for the host and
+    // writing it to the UART. Otherwise the frames end in
+    // an empty callback, which times the AX.25 layer.
+    static uint32_t bench_forwarding(bool toHost, uint16_t *frames) {
+        uint32_t cycles = 0;
+        uint32_t rxFrames = stats.rx_frames;
+        ax25_callback_t hook = AX25.hook;
+        if (!toHost) AX25.hook = bench_hook;
+
+        for (uint8_t run = 0; run < BENCH_FWD_RUNS; run++) {
+            fifo_flush(&modem.rxFifo);
+            fifo_push(&modem.rxFifo, HDLC_FLAG);
+            for (uint8_t i = 0; i < BENCH_FWD_LEN - 1; i++) fifo_push(&modem.rxFifo, 'A' + (i % 26));
+            // The last byte differs between runs, so the
+            // frames are not dropped as duplicates
+            fifo_push(&modem.rxFifo, '0' + run + (toHost ? BENCH_FWD_RUNS : 0));
+            fifo_push(&modem.rxFifo, HDLC_FLAG);
+
+            bench_start();
+            ax25_poll(&AX25);
+            cycles += bench_stop();
+        }
+
+        AX25.hook = hook;
+        *frames = stats.rx_frames - rxFrames;
+        return cycles / (BENCH_FWD_RUNS * BENCH_FWD_LEN);
+    }
+
+    #define BENCH_CLOCK_READS 64
+    static volatile ticks_t benchTicks;
+
+    // Times the clock readers, and returns the average
+    // CPU cycles per read. Type 0 is the old way of
+    // reading the clock with interrupts disabled, type 1
+    // the retrying 32 bit reader and type 2 the 16 bit
+    // reader.
+    static uint16_t bench_clock(uint8_t type) {
+        bench_start();
+        for (uint8_t i = 0; i < BENCH_CLOCK_READS; i++) {
+            if (type == 0) {
+                ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { benchTicks = _clock; }
+            } else if (type == 1) {
+                benchTicks = timer_clock();
+            } else {
+                benchTicks = timer_clock16();
+            }
+        }
+        return bench_stop() / BENCH_CLOCK_READS;
+    }
+
+    // Runs the ISR benchmark and prints a cycle report
+    // for each case on the serial port. This is meant to
+    // be run in simavr by the Makefile "bench" target.
+    static void benchmark(void) {
+        static uint8_t frame[64];
+        uint8_t *ptr = frame;
+        ptr = bench_putCall(ptr, "APZMDM", 0x60);
+        ptr = bench_putCall(ptr, "NOCALL", 0x61);
+        *ptr++ = AX25_CTRL_UI;
+        *ptr++ = AX25_PID_NOLAYER3;
+        while (ptr < frame + sizeof(frame)) *ptr++ = '0' + (rand() % 10);
+
+        // Receive only, on whatever the ADC sees
+        profile_reset();
+        delay_ms(1000);
+        profile_report(PSTR("RX only"));
+
+        // Transmit, with the demodulator running on
+        // silence as it does in half-duplex mode
+        modem.fullDuplex = false;
+        profile_reset();
+        ax25_sendRaw(&AX25, frame, sizeof(frame));
+        while (modem.sending) { /* Wait */ }
+        profile_report(PSTR("TX only"));
+
+        // Simultaneous, the demodulator decodes our own
+        // transmission through the profiling loopback
+        modem.fullDuplex = true;
+        stats_reset();
+        profile_reset();
+        ax25_sendRaw(&AX25, frame, sizeof(frame));
+        while (modem.sending) { ax25_poll(&AX25); }
+        profile_report(PSTR("RX+TX"));
+        printf_P(PSTR("Frames decoded: %lu\n"), stats.rx_frames);
+        modem.fullDuplex = false;
+
+        // Receive forwarding, without the interrupt. The
+        // frames sent to the host show up in the output.
+        uint16_t frames;
+        uint32_t perByte = bench_forwarding(false, &frames);
+        printf_P(PSTR("RX forwarding: %lu cycles/byte, %u frames\n"), perByte, frames);
+        perByte = bench_forwarding(true, &frames);
+        printf_P(PSTR("\nRX to host: %lu cycles/byte, %u frames\n"), perByte, frames);
+
+        // Clock reads
+        printf_P(PSTR("Clock read: %u cycles locked, %u cycles 32 bit, %u cycles 16 bit\n"),
+            bench_clock(0), bench_clock(1), bench_clock(2));
+
+        // Sleeping with interrupts disabled tells
+        // the simulator that we are done
+        cli();
+        sleep_mode();
+    }
+#endif
+
 int main (void) {
     init();
 
+    #if CONFIG_ISR_PROFILE
+        benchmark();
+    #endif
+
     #if SERIAL_PROTOCOL == PROTOCOL_KISS
         while (true) {
             ax25_poll(&AX25);
+            digi_poll(&AX25);
+            sched_poll();
             
             if (serial_available(0)) {
                 char sbyte = uart0_getchar_nowait();
                 kiss_serialCallback(sbyte);
             }
+
+            idle();
         }
     #endif
 
     #if SERIAL_PROTOCOL == PROTOCOL_SIMPLE_SERIAL
-        ticks_t start = timer_clock();
+        uint16_t start = timer_clock16();
         while (1) {    
             ax25_poll(&AX25);
+            digi_poll(&AX25);
+            sched_poll();
+
+            // A block is taken from the frame pool before
+            // reading the first byte of a command. While
+            // none are free, input waits in the UART FIFO.
+            if (!sertx && serialBuffer == NULL && serial_available(0)) {
+                serialBuffer = pool_get();
+            }
 
-            if (!sertx && serial_available(0)) {
+            if (!sertx && serialBuffer != NULL && serial_available(0)) {
                 sbyte = uart0_getchar_nowait();
 
                 #if SERIAL_DEBUG
@@ -101,20 +312,23 @@ int main (void) {
                         sertx = true;
                     }
 
-                    start = timer_clock();
+                    start = timer_clock16();
                 #endif
             } else {
-                if (!SERIAL_DEBUG && serialLen > 0 && timer_clock() - start > ms_to_ticks(TX_MAXWAIT)) {
+                if (!SERIAL_DEBUG && serialLen > 0 && (uint16_t)(timer_clock16() - start) > ms_to_ticks(TX_MAXWAIT)) {
                     sertx = true;
                 }
             }
 
             if (sertx) {
                 ss_serialCallback(serialBuffer, serialLen, &AX25);
+                pool_put(serialBuffer);
+                serialBuffer = NULL;
                 sertx = false;
                 serialLen = 0;
             }
 
+            idle();
         }
     #endif
 
@@ -8,81 +8,184 @@
 
 #include <string.h>
 #include <ctype.h>
+#include <util/atomic.h>
 #include "AX25.h"
 #include "protocol/HDLC.h"
 #include "util/CRC-CCIT.h"
+#include "util/stats.h"
+#include "util/pool.h"
+#include "Filter.h"
+#include "Dupe.h"
+#include "Digi.h"
+#include "Heard.h"
 #include "../hardware/AFSK.h"
+#include "../hardware/Calibration.h"
 
 #define countof(a) sizeof(a)/sizeof(a[0])
 #define MIN(a,b) ({ typeof(a) _a = (a); typeof(b) _b = (b); ((typeof(_a))((_a < _b) ? _a : _b)); })
 #define DECODE_CALL(buf, addr) for (unsigned i = 0; i < sizeof((addr)); i++) { char c = (*(buf)++ >> 1); (addr)[i] = (c == ' ') ? '\x0' : c; }
 #define AX25_SET_REPEATED(msg, idx, val) do { if (val) { (msg)->rpt_flags |= _BV(idx); } else { (msg)->rpt_flags &= ~_BV(idx) ; } } while(0)
 
-void ax25_init(AX25Ctx *ctx, Afsk *modem, FILE *channel, ax25_callback_t hook) {
+void ax25_init(AX25Ctx *ctx, Afsk *modem, ax25_callback_t hook) {
     memset(ctx, 0, sizeof(*ctx));
-    ctx->ch = channel;
     ctx->modem = modem;
     ctx->hook = hook;
-    ctx->crc_in = ctx->crc_out = CRC_CCIT_INIT_VAL;
+    ctx->crc_out = CRC_CCIT_INIT_VAL;
     ctx->ready_for_data = true;
 }
 
-static void ax25_decode(AX25Ctx *ctx) {
+bool ax25_view(const AX25Ctx *ctx, AX25View *view) {
+    if (ctx->buf == NULL || ctx->frame_len < AX25_MIN_FRAME_LEN) return false;
+
+    const uint8_t *buf = ctx->buf;
+    size_t len = ctx->frame_len - 2;
+    size_t pos = AX25_ADDR_LEN * 2;
+
+    // The last address of the path has the extension
+    // bit set in its SSID byte.
+    view->buf = buf;
+    view->rpt_count = 0;
+    while (!(buf[pos - 1] & 0x01)) {
+        if (view->rpt_count == AX25_MAX_RPT || pos + AX25_ADDR_LEN > len) return false;
+        view->rpt_count++;
+        pos += AX25_ADDR_LEN;
+    }
+
+    // Control fields are taken to be modulo 8, since
+    // telling an extended field apart needs the state
+    // of the connection.
+    if (pos >= len) return false;
+    view->ctrl = buf[pos++];
+
+    view->has_pid = !(view->ctrl & 0x01) || AX25_CTRL_IS_UI(view->ctrl);
+    view->pid = 0;
+    if (view->has_pid) {
+        if (pos >= len) return false;
+        view->pid = buf[pos++];
+    }
+
+    view->info = buf + pos;
+    view->info_len = len - pos;
+    return true;
+}
+
+bool ax25_addrEquals(const uint8_t *addr, const char *call, uint8_t ssid) {
+    // Compares an on-air address against a callsign of
+    // up to six characters, which is space padded.
+    for (uint8_t i = 0; i < 6; i++) {
+        char c = *call ? toupper(*call++) : ' ';
+        if (AX25_ADDR_CHAR(addr, i) != c) return false;
+    }
+    return *call == '\0' && AX25_ADDR_SSID(addr) == ssid;
+}
+
+#if SERIAL_PROTOCOL == PROTOCOL_SIMPLE_SERIAL
+    static void ax25_decodeCall(const uint8_t *buf, AX25Call *call) {
+        DECODE_CALL(buf, call->call);
+        call->ssid = (*buf >> 1) & 0x0F;
+    }
+#endif
+
+// Passes a received frame on to the protocol hook. The
+// view is NULL if the header could not be parsed.
+static void ax25_deliver(AX25Ctx *ctx, const AX25View *view) {
     #if SERIAL_PROTOCOL == PROTOCOL_KISS
         if (ctx->hook) ctx->hook(ctx);
     #endif
 
     #if SERIAL_PROTOCOL == PROTOCOL_SIMPLE_SERIAL
-        AX25Msg msg;
-        uint8_t *buf = ctx->buf;
+        if (view == NULL) { return; }
+        if (view->ctrl != AX25_CTRL_UI) { return; }
+        if (view->pid != AX25_PID_NOLAYER3) { return; }
 
-        DECODE_CALL(buf, msg.dst.call);
-        msg.dst.ssid = (*buf++ >> 1) & 0x0F;
+        AX25Msg msg;
+        ax25_decodeCall(ax25_viewDst(view), &msg.dst);
+        ax25_decodeCall(ax25_viewSrc(view), &msg.src);
+
+        msg.rpt_flags = 0;
+        for (msg.rpt_count = 0; msg.rpt_count < view->rpt_count; msg.rpt_count++) {
+            const uint8_t *addr = ax25_viewRpt(view, msg.rpt_count);
+            ax25_decodeCall(addr, &msg.rpt_list[msg.rpt_count]);
+            AX25_SET_REPEATED(&msg, msg.rpt_count, AX25_ADDR_REPEATED(addr));
+        }
 
-        DECODE_CALL(buf, msg.src.call);
-        msg.src.ssid = (*buf >> 1) & 0x0F;
+        msg.ctrl = view->ctrl;
+        msg.pid = view->pid;
+        msg.info = view->info;
+        msg.len = view->info_len;
 
-        for (msg.rpt_count = 0; !(*buf++ & 0x01) && (msg.rpt_count < countof(msg.rpt_list)); msg.rpt_count++) {
-            DECODE_CALL(buf, msg.rpt_list[msg.rpt_count].call);
-            msg.rpt_list[msg.rpt_count].ssid = (*buf >> 1) & 0x0F;
-            AX25_SET_REPEATED(&msg, msg.rpt_count, (*buf & 0x80));
-        }
+        if (ctx->hook) ctx->hook(&msg);        
 
-        msg.ctrl = *buf++;
-        if (msg.ctrl != AX25_CTRL_UI) { return; }
+    #endif
+}
 
-        msg.pid = *buf++;
-        if (msg.pid != AX25_PID_NOLAYER3) { return; }
+static void ax25_decode(AX25Ctx *ctx) {
+    AX25View view;
+    bool valid = ax25_view(ctx, &view);
+    if (valid && dupe_check(&view)) return;
+    if (valid) heard_update(&view, ctx->info.peak);
 
-        msg.len = ctx->frame_len - 2 - (buf - ctx->buf);
-        msg.info = buf;
+    if (filter_accept(valid ? &view : NULL)) {
+        ax25_deliver(ctx, valid ? &view : NULL);
+    }
 
-        if (ctx->hook) ctx->hook(&msg);        
+    // The digipeater runs last, since it changes the
+    // frame in place and may take over its buffer
+    if (valid) digi_receive(ctx, &view);
+}
 
-    #endif
+static void ax25_releaseBuf(AX25Ctx *ctx) {
+    pool_put(ctx->buf);
+    ctx->buf = NULL;
 }
 
 void ax25_poll(AX25Ctx *ctx) {
     int c;
     
-    while ((c = fgetc(ctx->ch)) != EOF) {
+    while ((c = afsk_read(ctx->modem)) != EOF) {
         if (!ctx->escape && c == HDLC_FLAG) {
-            if (ctx->frame_len >= AX25_MIN_FRAME_LEN) {
-                if (ctx->crc_in == AX25_CRC_CORRECT) {
-                    #if OPEN_SQUELCH == true
-                        LED_RX_ON();
-                    #endif
-                    ax25_decode(ctx);
+            // The modem has already checked the CRC, and
+            // sends a HDLC_RESET before the closing flag
+            // of invalid frames, so anything that is still
+            // in sync here is a good frame.
+            if (ctx->sync && ctx->frame_len >= AX25_MIN_FRAME_LEN) {
+                #if OPEN_SQUELCH == true
+                    LED_RX_ON();
+                #endif
+                stats.rx_frames++;
+                // The sample interrupt writes the metadata
+                // of every good frame it closes, so it is
+                // copied with interrupts off. If the modem
+                // has closed another frame since this one,
+                // its sequence number differs from the one
+                // sent with this frame, and the metadata is
+                // not ours and is dropped.
+                ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                    ctx->info = ctx->modem->hdlc.frame;
+                }
+                if (ctx->info.seq == ctx->seq) {
+                    calibration_frame(ctx->info.drift, ctx->frame_len);
+                } else {
+                    memset(&ctx->info, 0, sizeof(ctx->info));
                 }
+                ax25_decode(ctx);
             }
+            ax25_releaseBuf(ctx);
             ctx->sync = true;
-            ctx->crc_in = CRC_CCIT_INIT_VAL;
+            ctx->seqNext = false;
             ctx->frame_len = 0;
             continue;
         }
 
         if (!ctx->escape && c == HDLC_RESET) {
+            ax25_releaseBuf(ctx);
             ctx->sync = false;
+            ctx->seqNext = false;
+            continue;
+        }
+
+        if (!ctx->escape && c == HDLC_SEQ) {
+            ctx->seqNext = true;
             continue;
         }
 
@@ -91,10 +194,16 @@ void ax25_poll(AX25Ctx *ctx) {
             continue;
         }
 
-        if (ctx->sync) {
-            if (ctx->frame_len < AX25_MAX_FRAME_LEN) {
+        if (ctx->seqNext) {
+            ctx->seq = c;
+            ctx->seqNext = false;
+        } else if (ctx->sync) {
+            // Take a block from the frame pool when the
+            // first byte of a frame arrives. If none are
+            // free, the frame is dropped.
+            if (ctx->buf == NULL) ctx->buf = pool_getRx();
+            if (ctx->buf != NULL && ctx->frame_len < AX25_MAX_FRAME_LEN) {
                 ctx->buf[ctx->frame_len++] = c;
-                ctx->crc_in = update_crc_ccit(c, ctx->crc_in);
             } else {
                 ctx->sync = false;
             }
@@ -104,17 +213,30 @@ void ax25_poll(AX25Ctx *ctx) {
 
 }
 
+static void ax25_write(AX25Ctx *ctx, uint8_t c) {
+    // In full-duplex mode the demodulator keeps running
+    // while we transmit, so we drain received data while
+    // waiting for room in the modems transmit FIFO.
+    if (ctx->modem->fullDuplex) {
+        while (fifo_isfull_locked(&ctx->modem->txFifo)) {
+            ax25_poll(ctx);
+        }
+    }
+    afsk_write(ctx->modem, c);
+}
+
 static void ax25_putchar(AX25Ctx *ctx, uint8_t c)
 {
-    if (c == HDLC_FLAG || c == HDLC_RESET || c == AX25_ESC) fputc(AX25_ESC, ctx->ch);
+    if (c == HDLC_FLAG || c == HDLC_RESET || c == AX25_ESC) ax25_write(ctx, AX25_ESC);
     ctx->crc_out = update_crc_ccit(c, ctx->crc_out);
-    fputc(c, ctx->ch);
+    ax25_write(ctx, c);
 }
 
 void ax25_sendRaw(AX25Ctx *ctx, void *_buf, size_t len) {
     ctx->ready_for_data = false;
+    stats.tx_frames++;
     ctx->crc_out = CRC_CCIT_INIT_VAL;
-    fputc(HDLC_FLAG, ctx->ch);
+    ax25_write(ctx, HDLC_FLAG);
     const uint8_t *buf = (const uint8_t *)_buf;
     while (len--) ax25_putchar(ctx, *buf++);
 
@@ -123,7 +245,7 @@ void ax25_sendRaw(AX25Ctx *ctx, void *_buf, size_t len) {
     ax25_putchar(ctx, crcl);
     ax25_putchar(ctx, crch);
 
-    fputc(HDLC_FLAG, ctx->ch);
+    ax25_write(ctx, HDLC_FLAG);
 
     ctx->ready_for_data = true;
 }
@@ -148,11 +270,10 @@ void ax25_sendRaw(AX25Ctx *ctx, void *_buf, size_t len) {
         ax25_putchar(ctx, ssid);
     }
 
-    void ax25_sendVia(AX25Ctx *ctx, const AX25Call *path, size_t path_len, const void *_buf, size_t len) {
-        const uint8_t *buf = (const uint8_t *)_buf;
-
+    void ax25_sendSpans(AX25Ctx *ctx, const AX25Call *path, size_t path_len, const AX25Span *spans, size_t count) {
+        stats.tx_frames++;
         ctx->crc_out = CRC_CCIT_INIT_VAL;
-        fputc(HDLC_FLAG, ctx->ch);
+        ax25_write(ctx, HDLC_FLAG);
 
         for (size_t i = 0; i < path_len; i++) {
             ax25_sendCall(ctx, &path[i], (i == path_len - 1));
@@ -161,8 +282,12 @@ void ax25_sendRaw(AX25Ctx *ctx, void *_buf, size_t len) {
         ax25_putchar(ctx, AX25_CTRL_UI);
         ax25_putchar(ctx, AX25_PID_NOLAYER3);
 
-        while (len--) {
-            ax25_putchar(ctx, *buf++);
+        for (size_t i = 0; i < count; i++) {
+            const uint8_t *buf = (const uint8_t *)spans[i].buf;
+            size_t len = spans[i].len;
+            while (len--) {
+                ax25_putchar(ctx, *buf++);
+            }
         }
 
         uint8_t crcl = (ctx->crc_out & 0xff) ^ 0xff;
@@ -170,6 +295,11 @@ void ax25_sendRaw(AX25Ctx *ctx, void *_buf, size_t len) {
         ax25_putchar(ctx, crcl);
         ax25_putchar(ctx, crch);
 
-        fputc(HDLC_FLAG, ctx->ch);
+        ax25_write(ctx, HDLC_FLAG);
+    }
+
+    void ax25_sendVia(AX25Ctx *ctx, const AX25Call *path, size_t path_len, const void *_buf, size_t len) {
+        AX25Span span = { _buf, len };
+        ax25_sendSpans(ctx, path, path_len, &span, 1);
     }
 #endif
\ No newline at end of file
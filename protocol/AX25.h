@@ -22,8 +22,12 @@
 #define AX25_CRC_CORRECT  0xF0B8
 
 #define AX25_CTRL_UI      0x03
+#define AX25_CTRL_PF      0x10
 #define AX25_PID_NOLAYER3 0xF0
 
+#define AX25_ADDR_LEN     7
+#define AX25_MAX_RPT      8
+
 struct AX25Ctx;     // Forward declarations
 struct AX25Msg;
 
@@ -36,21 +40,49 @@ struct AX25Msg;
 #endif
 
 typedef struct AX25Ctx {
-    uint8_t buf[AX25_MAX_FRAME_LEN];
+    uint8_t *buf;               // Pool block owned while receiving a frame
     Afsk *modem;
-    FILE *ch;
     size_t frame_len;
-    uint16_t crc_in;
     uint16_t crc_out;
     ax25_callback_t hook;
     bool sync;
     bool escape;
     bool ready_for_data;
+    HdlcFrameInfo info;         // Receive metadata of the frame being handled
+    uint8_t seq;                // Sequence number sent with the last frame
+    bool seqNext;               // The next byte is a sequence number
 } AX25Ctx;
 
+// Zero-copy view of the header of a received frame.
+// Everything points into the frame buffer, so a view
+// is only valid while the frame is being handled by
+// the receive hook. Addresses are left in their on-air
+// form of six shifted characters and an SSID byte, and
+// are read with the AX25_ADDR_ macros below.
+typedef struct AX25View {
+    const uint8_t *buf;         // Start of the frame
+    uint8_t rpt_count;          // Number of digipeater addresses
+    uint8_t ctrl;               // Control field
+    bool has_pid;               // Only I and UI frames carry a PID
+    uint8_t pid;
+    const uint8_t *info;        // Information field, without FCS
+    size_t info_len;
+} AX25View;
+
+#define ax25_viewDst(view)     ((view)->buf)
+#define ax25_viewSrc(view)     ((view)->buf + AX25_ADDR_LEN)
+#define ax25_viewRpt(view, n)  ((view)->buf + AX25_ADDR_LEN * (2 + (n)))
+
+#define AX25_ADDR_CHAR(addr, i)  ((char)((addr)[(i)] >> 1))
+#define AX25_ADDR_SSID(addr)     (((addr)[6] >> 1) & 0x0F)
+#define AX25_ADDR_REPEATED(addr) ((addr)[6] & 0x80)
+#define AX25_CTRL_IS_UI(ctrl)    (((ctrl) & ~AX25_CTRL_PF) == AX25_CTRL_UI)
+
+bool ax25_view(const AX25Ctx *ctx, AX25View *view);
+bool ax25_addrEquals(const uint8_t *addr, const char *call, uint8_t ssid);
+
 #if SERIAL_PROTOCOL == PROTOCOL_SIMPLE_SERIAL
     #define AX25_CALL(str, id) {.call = (str), .ssid = (id) }
-    #define AX25_MAX_RPT 8
     #define AX25_REPEATED(msg, n) ((msg)->rpt_flags & BV(n))
 
     typedef struct AX25Call {
@@ -70,6 +102,15 @@ typedef struct AX25Ctx {
         size_t len;
     } AX25Msg;
 
+    // A frame payload can be given as a list of spans,
+    // which are sent back to back. This lets callers add
+    // headers to data without assembling a copy first.
+    typedef struct AX25Span {
+        const void *buf;
+        size_t len;
+    } AX25Span;
+
+    void ax25_sendSpans(AX25Ctx *ctx, const AX25Call *path, size_t path_len, const AX25Span *spans, size_t count);
     void ax25_sendVia(AX25Ctx *ctx, const AX25Call *path, size_t path_len, const void *_buf, size_t len);
     #define ax25_send(ctx, dst, src, buf, len) ax25_sendVia(ctx, ({static AX25Call __path[]={dst, src}; __path;}), 2, buf, len)
     
@@ -77,6 +118,6 @@ typedef struct AX25Ctx {
 
 void ax25_poll(AX25Ctx *ctx);
 void ax25_sendRaw(AX25Ctx *ctx, void *_buf, size_t len);
-void ax25_init(AX25Ctx *ctx, Afsk *modem, FILE *channel, ax25_callback_t hook);
+void ax25_init(AX25Ctx *ctx, Afsk *modem, ax25_callback_t hook);
 
 #endif
\ No newline at end of file
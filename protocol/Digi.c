@@ -0,0 +1,245 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <avr/eeprom.h>
+#include "Digi.h"
+#include "Dupe.h"
+#include "util/pool.h"
+#include "util/settings.h"
+#include "util/stats.h"
+#include "util/time.h"
+
+#if SERIAL_PROTOCOL == PROTOCOL_KISS
+    #include "KISS.h"
+#else
+    #include "util/sched.h"
+#endif
+
+#if CONFIG_DIGI_DUPE_SIZE < 1 || CONFIG_DIGI_DUPE_TICKS < 1
+    #error The digipeater duplicate check can not be turned off!
+#endif
+
+DigiSettings digi = {
+    .enabled = false,
+    .max_hops = 2,
+    .call = { 'N', 'O', 'C', 'A', 'L', 'L', 0 },
+};
+
+// A frame waiting to be repeated. The buffer is the
+// pool block it was received into, which the AX.25
+// layer hands over to us.
+static uint8_t *queued;
+static size_t queuedLen;
+
+// UI frames we repeated recently, written in a ring so
+// the oldest one is always the next to be replaced
+typedef struct DigiDupe {
+    uint16_t crc;
+    ticks_t time;       // Clock value when the frame was repeated
+} DigiDupe;
+
+static DigiDupe repeated[CONFIG_DIGI_DUPE_SIZE];
+static uint8_t repeatedNext;
+static uint8_t repeatedFilled;
+
+#define NV_MAGIC_BYTE 0x44
+
+// A stored callsign of six characters has no zero at
+// the end, so it is copied into a string to compare it
+static bool digi_addrEquals(const uint8_t *addr, const uint8_t *call) {
+    char str[7];
+    memcpy(str, call, 6);
+    str[6] = '\0';
+    return ax25_addrEquals(addr, str, call[6]);
+}
+
+static bool digi_isUs(const uint8_t *addr) {
+    if (digi_addrEquals(addr, digi.call)) return true;
+    for (uint8_t i = 0; i < CONFIG_DIGI_ALIASES; i++) {
+        const uint8_t *alias = digi.aliases[i];
+        if (alias[0] != 0 && digi_addrEquals(addr, alias)) return true;
+    }
+    return false;
+}
+
+// Returns n for a WIDEn-N path entry, or 0 if the
+// address is something else
+static uint8_t digi_wideHops(const uint8_t *addr) {
+    if (AX25_ADDR_CHAR(addr, 0) != 'W' || AX25_ADDR_CHAR(addr, 1) != 'I' ||
+        AX25_ADDR_CHAR(addr, 2) != 'D' || AX25_ADDR_CHAR(addr, 3) != 'E' ||
+        AX25_ADDR_CHAR(addr, 5) != ' ') return 0;
+
+    char n = AX25_ADDR_CHAR(addr, 4);
+    if (n < '1' || n > '7') return 0;
+    return n - '0';
+}
+
+static bool digi_isDupe(uint16_t crc, ticks_t now) {
+    for (uint8_t i = 0; i < repeatedFilled; i++) {
+        if (repeated[i].crc == crc && now - repeated[i].time < CONFIG_DIGI_DUPE_TICKS) return true;
+    }
+    return false;
+}
+
+static void digi_remember(uint16_t crc, ticks_t now) {
+    repeated[repeatedNext].crc = crc;
+    repeated[repeatedNext].time = now;
+    if (++repeatedNext == CONFIG_DIGI_DUPE_SIZE) repeatedNext = 0;
+    if (repeatedFilled < CONFIG_DIGI_DUPE_SIZE) repeatedFilled++;
+}
+
+// Writes our own callsign as a used path entry
+static void digi_putCall(uint8_t *addr) {
+    for (uint8_t i = 0; i < 6; i++) {
+        addr[i] = (digi.call[i] ? toupper(digi.call[i]) : ' ') << 1;
+    }
+    addr[6] = 0x80 | 0x60 | (digi.call[6] << 1) | (addr[6] & 0x01);
+}
+
+void digi_receive(AX25Ctx *ctx, const AX25View *view) {
+    if (!digi.enabled) return;
+
+    uint8_t i = 0;
+    while (i < view->rpt_count && AX25_ADDR_REPEATED(ax25_viewRpt(view, i))) i++;
+    if (i == view->rpt_count) return;
+
+    // The view points into the frame buffer, which we
+    // are allowed to change at this point
+    uint8_t *buf = ctx->buf;
+    size_t len = ctx->frame_len - 2;
+    size_t pos = ax25_viewRpt(view, i) - buf;
+    uint8_t *addr = buf + pos;
+
+    bool isUs = digi_isUs(addr);
+    uint8_t n = 0;
+    uint8_t hops = 0;
+    if (!isUs) {
+        n = digi_wideHops(addr);
+        hops = AX25_ADDR_SSID(addr);
+        if (n == 0 || n > digi.max_hops || hops == 0 || hops > n) return;
+    }
+
+    // Copies of a UI frame that reach us over several
+    // paths are only repeated once. This is checked
+    // before the path is changed, since inserting our
+    // callsign moves the information field.
+    bool ui = AX25_CTRL_IS_UI(view->ctrl);
+    uint16_t crc = ui ? dupe_crc(view) : 0;
+    ticks_t now = timer_clock();
+    if (ui && digi_isDupe(crc, now)) return;
+
+    // Only one frame waits to be repeated at a time.
+    // Frames that should be repeated while it waits
+    // are counted, so a busy digipeater shows up in
+    // the statistics.
+    if (queued != NULL) {
+        stats.digi_dropped++;
+        return;
+    }
+
+    if (isUs) {
+        // Callsign substitution for our call or alias
+        digi_putCall(addr);
+    } else {
+        hops--;
+        addr[6] = (addr[6] & ~0x1E) | (hops << 1);
+        if (hops == 0) addr[6] |= 0x80;
+
+        if (view->rpt_count < AX25_MAX_RPT && len + AX25_ADDR_LEN <= POOL_BLOCK_SIZE) {
+            // Insert our callsign in front of the WIDEn-N
+            // entry, so the path shows who repeated it
+            memmove(addr + AX25_ADDR_LEN, addr, len - pos);
+            addr[6] = 0;
+            digi_putCall(addr);
+            len += AX25_ADDR_LEN;
+        } else if (hops == 0) {
+            digi_putCall(addr);
+        }
+    }
+
+    // Take over the buffer, and repeat the frame from
+    // the main loop once the AX.25 layer is done. If
+    // the pool can not spare it, the frame is not
+    // repeated.
+    if (!pool_keep(buf)) {
+        stats.digi_dropped++;
+        return;
+    }
+    queued = buf;
+    queuedLen = len;
+    ctx->buf = NULL;
+    if (ui) digi_remember(crc, now);
+}
+
+#if SERIAL_PROTOCOL != PROTOCOL_KISS
+    static AX25Ctx *digiCtx;
+
+    // Channel access for the queued frame, using the
+    // same p-persistent CSMA as the KISS transmit queue.
+    // Instead of waiting, the task schedules itself to
+    // try again, so the main loop keeps running.
+    static void digi_csmaTask(void) {
+        if (queued == NULL) return;
+        Afsk *modem = digiCtx->modem;
+
+        if (!modem->fullDuplex) {
+            if (modem->hdlc.dcd || modem->carrier) {
+                sched_after(0, digi_csmaTask);
+                return;
+            }
+            if ((rand() & 0xFF) >= CONFIG_DIGI_PERSISTENCE) {
+                sched_after(ms_to_ticks(CONFIG_DIGI_SLOTTIME), digi_csmaTask);
+                return;
+            }
+        }
+
+        ax25_sendRaw(digiCtx, queued, queuedLen);
+        pool_put(queued);
+        queued = NULL;
+    }
+#endif
+
+void digi_poll(AX25Ctx *ctx) {
+    if (queued == NULL) return;
+
+    #if SERIAL_PROTOCOL == PROTOCOL_KISS
+        // The transmit queue takes over the buffer. If
+        // it is full, we try again on the next pass.
+        if (!kiss_queue(queued, queuedLen, 0)) return;
+        queued = NULL;
+    #else
+        // The channel access task sends the frame and
+        // gives the buffer back. If no timer is free to
+        // start it, we try again on the next pass.
+        digiCtx = ctx;
+        if (!sched_pending(digi_csmaTask)) {
+            ticks_t wait = ctx->modem->fullDuplex ? 0 : ms_to_ticks(CONFIG_AFSK_TXWAIT);
+            sched_after(wait, digi_csmaTask);
+        }
+    #endif
+}
+
+bool digi_loadSettings(void) {
+    if (settings_valid() && eeprom_read_byte((void*)&nv.digi.magic) == NV_MAGIC_BYTE) {
+        eeprom_read_block((void*)&digi, (void*)&nv.digi.settings, sizeof(digi));
+        return true;
+    } else {
+        return false;
+    }
+}
+
+void digi_saveSettings(void) {
+    settings_stamp();
+    eeprom_update_block((void*)&digi, (void*)&nv.digi.settings, sizeof(digi));
+    eeprom_update_byte((void*)&nv.digi.magic, NV_MAGIC_BYTE);
+}
+
+void digi_clearSettings(void) {
+    eeprom_update_byte((void*)&nv.digi.magic, 0xFF);
+}
@@ -0,0 +1,44 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+#ifndef PROTOCOL_DIGI_H
+#define PROTOCOL_DIGI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "device.h"
+#include "AX25.h"
+
+// Standalone digipeater. Received frames are repeated
+// when the first unused entry of their path is our own
+// callsign, one of the aliases, or a WIDEn-N entry with
+// n up to max_hops.
+//
+// Repeated frames are sent through the KISS transmit
+// queue, or in SimpleSerial builds by a scheduled CSMA
+// task. A UI frame is not repeated again within
+// CONFIG_DIGI_DUPE_TICKS.
+//
+// Callsigns are stored as six characters padded with
+// zeroes, followed by the SSID. An alias with an empty
+// callsign is unused.
+typedef struct DigiSettings {
+    bool enabled;
+    uint8_t max_hops;       // Largest n of WIDEn-N paths to repeat
+    uint8_t call[7];        // Our callsign, put into the path
+    uint8_t aliases[CONFIG_DIGI_ALIASES][7];
+} DigiSettings;
+
+extern DigiSettings digi;
+
+void digi_receive(AX25Ctx *ctx, const AX25View *view);
+void digi_poll(AX25Ctx *ctx);
+
+bool digi_loadSettings(void);
+void digi_saveSettings(void);
+void digi_clearSettings(void);
+
+#endif
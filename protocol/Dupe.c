@@ -0,0 +1,57 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+#include "Dupe.h"
+#include "util/CRC-CCIT.h"
+#include "util/time.h"
+
+typedef struct DupeEntry {
+    uint16_t crc;
+    ticks_t time;       // Clock value when the frame was first seen
+} DupeEntry;
+
+// Entries are written in a ring, so the oldest one is
+// always the next to be replaced
+static DupeEntry cache[CONFIG_DUPE_CACHE_SIZE];
+static uint8_t next;
+static uint8_t filled;
+
+static uint16_t dupe_updateAddr(const uint8_t *addr, uint16_t crc) {
+    // Only the callsign and SSID are used, since the
+    // other bits of the SSID byte depend on the path
+    for (uint8_t i = 0; i < 6; i++) crc = update_crc_ccit(addr[i], crc);
+    return update_crc_ccit(AX25_ADDR_SSID(addr), crc);
+}
+
+uint16_t dupe_crc(const AX25View *view) {
+    uint16_t crc = CRC_CCIT_INIT_VAL;
+    crc = dupe_updateAddr(ax25_viewDst(view), crc);
+    crc = dupe_updateAddr(ax25_viewSrc(view), crc);
+    crc = update_crc_ccit(view->pid, crc);
+    for (size_t i = 0; i < view->info_len; i++) crc = update_crc_ccit(view->info[i], crc);
+    return crc;
+}
+
+bool dupe_check(const AX25View *view) {
+    if (CONFIG_DUPE_TICKS == 0) return false;
+
+    // Connected mode frames are left alone. Supervisory
+    // frames between two stations all look the same, and
+    // retransmitted I frames must reach the host.
+    if (!AX25_CTRL_IS_UI(view->ctrl)) return false;
+
+    uint16_t crc = dupe_crc(view);
+    ticks_t now = timer_clock();
+    for (uint8_t i = 0; i < filled; i++) {
+        if (cache[i].crc == crc && now - cache[i].time < CONFIG_DUPE_TICKS) return true;
+    }
+
+    cache[next].crc = crc;
+    cache[next].time = now;
+    if (++next == CONFIG_DUPE_CACHE_SIZE) next = 0;
+    if (filled < CONFIG_DUPE_CACHE_SIZE) filled++;
+    return false;
+}
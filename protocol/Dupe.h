@@ -0,0 +1,33 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+#ifndef PROTOCOL_DUPE_H
+#define PROTOCOL_DUPE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "device.h"
+#include "AX25.h"
+
+// Cache of recently received frames, used to drop the
+// extra copies of a packet that arrive when several
+// digipeaters repeat it. Only UI frames are checked,
+// since connected mode has its own retransmissions.
+// Frames are identified by a CRC of the source and
+// destination addresses, the PID and the information
+// field, so copies that took different paths are still
+// recognised as the same packet.
+//
+// Returns true if the frame was already seen within
+// the last CONFIG_DUPE_TICKS sample clock ticks, and
+// otherwise remembers it and returns false.
+bool dupe_check(const AX25View *view);
+
+// The CRC that identifies a frame, as described above.
+// The digipeater uses it for its own duplicate check.
+uint16_t dupe_crc(const AX25View *view);
+
+#endif
@@ -0,0 +1,118 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+#include <string.h>
+#include <ctype.h>
+#include <avr/eeprom.h>
+#include "Filter.h"
+#include "util/settings.h"
+
+static FilterRule rules[CONFIG_FILTER_RULES];
+static uint8_t ruleCount;   // Number of entries in use
+
+#define NV_MAGIC_BYTE 0x46
+
+static void filter_count(void) {
+    ruleCount = 0;
+    for (uint8_t i = 0; i < CONFIG_FILTER_RULES; i++) {
+        if (rules[i].type != FILTER_NONE) ruleCount++;
+    }
+}
+
+static bool filter_matchCall(const FilterRule *rule, const uint8_t *addr) {
+    for (uint8_t i = 0; i < 6; i++) {
+        char c = rule->value[i] ? rule->value[i] : ' ';
+        if (AX25_ADDR_CHAR(addr, i) != c) return false;
+    }
+    return rule->value[6] == FILTER_ANY_SSID || rule->value[6] == AX25_ADDR_SSID(addr);
+}
+
+static uint8_t filter_frameType(uint8_t ctrl) {
+    if (!(ctrl & 0x01)) return FILTER_FRAME_I;
+    if ((ctrl & 0x03) == 0x01) return FILTER_FRAME_S;
+    if (AX25_CTRL_IS_UI(ctrl)) return FILTER_FRAME_UI;
+    return FILTER_FRAME_U;
+}
+
+static bool filter_match(const FilterRule *rule, const AX25View *view) {
+    if (rule->type == FILTER_SRC) return filter_matchCall(rule, ax25_viewSrc(view));
+    if (rule->type == FILTER_DST) return filter_matchCall(rule, ax25_viewDst(view));
+    if (rule->type == FILTER_PATH) {
+        for (uint8_t i = 0; i < view->rpt_count; i++) {
+            if (filter_matchCall(rule, ax25_viewRpt(view, i))) return true;
+        }
+        return false;
+    }
+    if (rule->type == FILTER_DTI) return view->info_len > 0 && view->info[0] == rule->value[0];
+    if (rule->type == FILTER_FRAME) return filter_frameType(view->ctrl) == rule->value[0];
+    return false;
+}
+
+// Decides whether a received frame is forwarded to
+// the host. The view is NULL for frames with a header
+// that could not be parsed, and these are only let
+// through while no filters are set.
+bool filter_accept(const AX25View *view) {
+    if (ruleCount == 0) return true;
+    if (view == NULL) return false;
+
+    for (uint8_t i = 0; i < CONFIG_FILTER_RULES; i++) {
+        if (filter_match(&rules[i], view)) return true;
+    }
+    return false;
+}
+
+bool filter_get(uint8_t index, FilterRule *rule) {
+    if (index >= CONFIG_FILTER_RULES) return false;
+    *rule = rules[index];
+    return true;
+}
+
+bool filter_set(uint8_t index, const FilterRule *rule) {
+    if (index >= CONFIG_FILTER_RULES || rule->type > FILTER_FRAME) return false;
+
+    rules[index] = *rule;
+    if (rule->type == FILTER_SRC || rule->type == FILTER_DST || rule->type == FILTER_PATH) {
+        // Callsigns are always upper case on the air
+        for (uint8_t i = 0; i < 6; i++) rules[index].value[i] = toupper(rule->value[i]);
+    }
+    filter_count();
+    return true;
+}
+
+// Puts a rule in the first free entry of the table,
+// and returns false if the table is full
+bool filter_add(const FilterRule *rule) {
+    for (uint8_t i = 0; i < CONFIG_FILTER_RULES; i++) {
+        if (rules[i].type == FILTER_NONE) return filter_set(i, rule);
+    }
+    return false;
+}
+
+void filter_clear(void) {
+    memset(rules, 0, sizeof(rules));
+    ruleCount = 0;
+}
+
+bool filter_loadSettings(void) {
+    if (settings_valid() && eeprom_read_byte((void*)&nv.filter.magic) == NV_MAGIC_BYTE) {
+        eeprom_read_block((void*)rules, (void*)nv.filter.rules, sizeof(rules));
+        filter_count();
+        return true;
+    } else {
+        return false;
+    }
+}
+
+void filter_saveSettings(void) {
+    settings_stamp();
+    eeprom_update_block((void*)rules, (void*)nv.filter.rules, sizeof(rules));
+    eeprom_update_byte((void*)&nv.filter.magic, NV_MAGIC_BYTE);
+}
+
+void filter_clearSettings(void) {
+    eeprom_update_byte((void*)&nv.filter.magic, 0xFF);
+}
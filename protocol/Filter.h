@@ -0,0 +1,55 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+#ifndef PROTOCOL_FILTER_H
+#define PROTOCOL_FILTER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "device.h"
+#include "AX25.h"
+
+// Receive filter table. Each rule matches one field of
+// the AX.25 header, and a received frame is forwarded
+// to the host if any rule matches it. When the table
+// is empty, every frame is forwarded.
+//
+// Callsign rules hold a callsign of up to six
+// characters, padded with zeroes, followed by the SSID
+// to match, or FILTER_ANY_SSID. Data type rules hold
+// the APRS data type identifier (the first character
+// of the information field), and frame type rules hold
+// one of the FILTER_FRAME_ types.
+#define FILTER_NONE   0x00      // Unused table entry
+#define FILTER_SRC    0x01      // Source callsign
+#define FILTER_DST    0x02      // Destination callsign
+#define FILTER_PATH   0x03      // Any digipeater in the path
+#define FILTER_DTI    0x04      // APRS data type identifier
+#define FILTER_FRAME  0x05      // AX.25 frame type
+
+#define FILTER_ANY_SSID 0xFF
+
+#define FILTER_FRAME_I  0x00
+#define FILTER_FRAME_S  0x01
+#define FILTER_FRAME_U  0x02
+#define FILTER_FRAME_UI 0x03
+
+typedef struct FilterRule {
+    uint8_t type;
+    uint8_t value[7];
+} FilterRule;
+
+bool filter_accept(const AX25View *view);
+bool filter_get(uint8_t index, FilterRule *rule);
+bool filter_set(uint8_t index, const FilterRule *rule);
+bool filter_add(const FilterRule *rule);
+void filter_clear(void);
+
+bool filter_loadSettings(void);
+void filter_saveSettings(void);
+void filter_clearSettings(void);
+
+#endif
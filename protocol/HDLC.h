@@ -11,4 +11,8 @@
 #define HDLC_RESET 0x7F
 #define AX25_ESC   0x1B
 
+// Only used in the receive FIFO, in front of the
+// sequence number of a good frame's metadata
+#define HDLC_SEQ   0x7D
+
 #endif
\ No newline at end of file
@@ -0,0 +1,103 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+#include <string.h>
+#include "Heard.h"
+
+#define HEARD_NONE 0xFF
+#define HEARD_BUCKETS 8     // Must be a power of two
+
+#if CONFIG_HEARD_SIZE >= HEARD_NONE
+    #error The heard list supports at most 254 entries!
+#endif
+
+static HeardEntry table[CONFIG_HEARD_SIZE];
+static uint8_t buckets[HEARD_BUCKETS] = { [0 ... HEARD_BUCKETS-1] = HEARD_NONE };
+static uint8_t used;
+static uint8_t newest = HEARD_NONE;
+static uint8_t oldest = HEARD_NONE;
+
+static uint8_t heard_hash(const uint8_t *call) {
+    uint8_t hash = 0;
+    for (uint8_t i = 0; i < 7; i++) hash = ((hash << 1) | (hash >> 7)) ^ call[i];
+    return hash & (HEARD_BUCKETS - 1);
+}
+
+static void heard_unlinkAge(uint8_t i) {
+    HeardEntry *entry = &table[i];
+    if (entry->newer != HEARD_NONE) table[entry->newer].older = entry->older; else newest = entry->older;
+    if (entry->older != HEARD_NONE) table[entry->older].newer = entry->newer; else oldest = entry->newer;
+}
+
+static void heard_linkNewest(uint8_t i) {
+    table[i].newer = HEARD_NONE;
+    table[i].older = newest;
+    if (newest != HEARD_NONE) table[newest].newer = i; else oldest = i;
+    newest = i;
+}
+
+static void heard_unlinkBucket(uint8_t i) {
+    uint8_t *link = &buckets[heard_hash(table[i].call)];
+    while (*link != i) link = &table[*link].chain;
+    *link = table[i].chain;
+}
+
+void heard_update(const AX25View *view, uint8_t level) {
+    uint8_t call[7];
+    const uint8_t *addr = ax25_viewSrc(view);
+    for (uint8_t i = 0; i < 6; i++) {
+        char c = AX25_ADDR_CHAR(addr, i);
+        call[i] = (c == ' ') ? 0 : c;
+    }
+    call[6] = AX25_ADDR_SSID(addr);
+
+    uint8_t bucket = heard_hash(call);
+    uint8_t i = buckets[bucket];
+    while (i != HEARD_NONE && memcmp(table[i].call, call, sizeof(call)) != 0) i = table[i].chain;
+
+    if (i != HEARD_NONE) {
+        heard_unlinkAge(i);
+    } else {
+        // Take a free entry, or reuse the station that
+        // was heard longest ago
+        if (used < CONFIG_HEARD_SIZE) {
+            i = used++;
+        } else {
+            i = oldest;
+            heard_unlinkAge(i);
+            heard_unlinkBucket(i);
+        }
+        memcpy(table[i].call, call, sizeof(call));
+        table[i].count = 0;
+        table[i].chain = buckets[bucket];
+        buckets[bucket] = i;
+    }
+    heard_linkNewest(i);
+
+    // The packet was heard directly if none of the
+    // digipeaters in its path have repeated it yet
+    bool direct = true;
+    for (uint8_t n = 0; n < view->rpt_count; n++) {
+        if (AX25_ADDR_REPEATED(ax25_viewRpt(view, n))) direct = false;
+    }
+
+    HeardEntry *entry = &table[i];
+    entry->last = timer_clock();
+    if (entry->count < UINT16_MAX) entry->count++;
+    entry->direct = direct;
+    entry->level = level;
+}
+
+uint8_t heard_count(void) {
+    return used;
+}
+
+// Returns the n'th most recently heard station
+const HeardEntry *heard_get(uint8_t n) {
+    uint8_t i = newest;
+    while (n-- && i != HEARD_NONE) i = table[i].older;
+    return (i != HEARD_NONE) ? &table[i] : NULL;
+}
@@ -0,0 +1,40 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+#ifndef PROTOCOL_HEARD_H
+#define PROTOCOL_HEARD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "device.h"
+#include "util/time.h"
+#include "AX25.h"
+
+// List of recently heard stations. When the list is
+// full, the station that was heard longest ago is
+// replaced. Stations are found through a small hash
+// table, and the entries are kept in a list ordered by
+// when they were last heard, so updating the list for a
+// received frame takes constant time.
+//
+// Callsigns are stored as six characters padded with
+// zeroes, followed by the SSID.
+typedef struct HeardEntry {
+    uint8_t call[7];
+    ticks_t last;           // Clock value when last heard
+    uint16_t count;         // Number of packets heard
+    bool direct;            // Last packet was not digipeated
+    uint8_t level;          // Peak audio level of the last packet, 0-128
+    uint8_t chain;          // Next entry in the same hash bucket
+    uint8_t newer;          // Neighbours in the recently heard list
+    uint8_t older;
+} HeardEntry;
+
+void heard_update(const AX25View *view, uint8_t level);
+uint8_t heard_count(void);
+const HeardEntry *heard_get(uint8_t n);
+
+#endif
@@ -6,31 +6,148 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
 
 #include "device.h"
 #include "KISS.h"
+#include "../util/CRC-CCIT.h"
+#include "../util/stats.h"
+#include "../util/pool.h"
+#include "../util/ram.h"
+#include "../util/sched.h"
+#include "../util/settings.h"
+#include "Filter.h"
+#include "Digi.h"
+#include "Heard.h"
+#include "Load.h"
+#include "../hardware/Calibration.h"
 
-static uint8_t serialBuffer[AX25_MAX_FRAME_LEN]; // Buffer for holding incoming serial data
+// The TX preamble and tail are shared with the
+// SimpleSerial protocol, everything else below is
+// only used in KISS builds
+unsigned long custom_preamble = CONFIG_AFSK_PREAMBLE_LEN;
+unsigned long custom_tail = CONFIG_AFSK_TRAILER_LEN;
+
+#if SERIAL_PROTOCOL == PROTOCOL_KISS
+#if 1 + CONFIG_HEARD_SIZE * 15 > AX25_MAX_FRAME_LEN
+    #error The heard list does not fit in a SETHARDWARE reply!
+#endif
+
+static uint8_t *serialBuffer;   // Pool block holding incoming serial data
 AX25Ctx *ax25ctx;
 Afsk *channel;
-Serial *serial;
 size_t frame_len;
 bool IN_FRAME;
 bool ESCAPE;
+bool TOO_LONG;          // The frame being received did not fit in a block
 bool FLOWCONTROL;
 
+uint8_t ackSeq[2];      // Sequence ID of the ACKMODE frame being received
+uint8_t ackLen;
+
+uint8_t crcMode = CRC_MODE_NONE;    // CRC mode negotiated with the host
+uint8_t frameCrcMode;               // CRC mode of the frame being received
+uint16_t frameCrc;
+
 uint8_t command = CMD_UNKNOWN;
-unsigned long custom_preamble = CONFIG_AFSK_PREAMBLE_LEN;
-unsigned long custom_tail = CONFIG_AFSK_TRAILER_LEN;
+
+// Frames waiting for channel access. Each one owns the
+// pool block it is stored in, and the pool gives out
+// at most POOL_MAX_HELD blocks outside the receive path.
+#define KISS_TX_QUEUE POOL_MAX_HELD
+
+typedef struct TxFrame {
+    uint8_t *buf;
+    size_t len;
+    uint8_t flags;
+    bool sent;              // Handed to the modem, waiting for the ack
+    uint8_t ackSeq[2];
+} TxFrame;
+
+static TxFrame txQueue[KISS_TX_QUEUE];
+static uint8_t txHead;
+static uint8_t txCount;
+
+static void kiss_csmaTask(void);
+static void kiss_sendRxInfo(const HdlcFrameInfo *info);
 
 unsigned long slotTime = 200;
 uint8_t p = 63;
+bool adaptiveCsma = false;
+bool rxInfo = false;
+bool flexnet = false;   // Whether command 0x20 is a FlexNet data frame
 
-void kiss_init(AX25Ctx *ax25, Afsk *afsk, Serial *ser) {
+#define NV_MAGIC_BYTE 0x4B
+
+void kiss_init(AX25Ctx *ax25, Afsk *afsk) {
     ax25ctx = ax25;
-    serial = ser;
     channel = afsk;
     FLOWCONTROL = false;
+
+    kiss_loadSettings();
+}
+
+bool kiss_loadSettings(void) {
+    filter_loadSettings();
+    digi_loadSettings();
+    if (settings_valid() && eeprom_read_byte((void*)&nv.kiss.magic) == NV_MAGIC_BYTE) {
+        custom_preamble = eeprom_read_word((void*)&nv.kiss.preamble);
+        custom_tail = eeprom_read_word((void*)&nv.kiss.tail);
+        slotTime = eeprom_read_word((void*)&nv.kiss.slotTime);
+        p = eeprom_read_byte((void*)&nv.kiss.p);
+        channel->fullDuplex = eeprom_read_byte((void*)&nv.kiss.fullDuplex);
+        FLOWCONTROL = eeprom_read_byte((void*)&nv.kiss.flowControl);
+        adaptiveCsma = eeprom_read_byte((void*)&nv.kiss.adaptiveCsma);
+        rxInfo = eeprom_read_byte((void*)&nv.kiss.rxInfo);
+        flexnet = eeprom_read_byte((void*)&nv.kiss.flexnet);
+        return true;
+    } else {
+        return false;
+    }
+}
+
+void kiss_saveSettings(void) {
+    settings_stamp();
+    eeprom_update_word((void*)&nv.kiss.preamble, custom_preamble);
+    eeprom_update_word((void*)&nv.kiss.tail, custom_tail);
+    eeprom_update_word((void*)&nv.kiss.slotTime, slotTime);
+    eeprom_update_byte((void*)&nv.kiss.p, p);
+    eeprom_update_byte((void*)&nv.kiss.fullDuplex, channel->fullDuplex);
+    eeprom_update_byte((void*)&nv.kiss.flowControl, FLOWCONTROL);
+    eeprom_update_byte((void*)&nv.kiss.adaptiveCsma, adaptiveCsma);
+    eeprom_update_byte((void*)&nv.kiss.rxInfo, rxInfo);
+    eeprom_update_byte((void*)&nv.kiss.flexnet, flexnet);
+    filter_saveSettings();
+    digi_saveSettings();
+
+    eeprom_update_byte((void*)&nv.kiss.magic, NV_MAGIC_BYTE);
+}
+
+void kiss_clearSettings(void) {
+    eeprom_update_byte((void*)&nv.kiss.magic, 0xFF);
+    filter_clearSettings();
+    digi_clearSettings();
+}
+
+static inline void kiss_putEscaped(uint8_t b) {
+    if (b == FEND) {
+        serial_write(FESC);
+        serial_write(TFEND);
+    } else if (b == FESC) {
+        serial_write(FESC);
+        serial_write(TFESC);
+    } else {
+        serial_write(b);
+    }
+}
+
+static uint16_t kiss_updateCrc(uint8_t mode, uint8_t b, uint16_t crc) {
+    if (mode == CRC_MODE_SMACK) {
+        return _crc16_update(crc, b);
+    } else {
+        return update_crc_flex(b, crc);
+    }
 }
 
 //size_t decodes = 0;
@@ -38,89 +155,443 @@ void kiss_messageCallback(AX25Ctx *ctx) {
     // decodes++;
     // printf("%d\r\n", decodes);
 
-    fputc(FEND, &serial->uart0);
-    fputc(0x00, &serial->uart0);
+    uint8_t cmd = CMD_DATA;
+    uint16_t crc = SMACK_CRC_INIT_VAL;
+    if (crcMode == CRC_MODE_SMACK) {
+        cmd = CMD_SMACK_DATA;
+    } else if (crcMode == CRC_MODE_FLEXNET) {
+        cmd = CMD_FLEXNET_DATA;
+        crc = CRC_FLEX_INIT_VAL;
+    }
+
+    serial_write(FEND);
+    serial_write(cmd);
+    if (crcMode != CRC_MODE_NONE) crc = kiss_updateCrc(crcMode, cmd, crc);
     for (unsigned i = 0; i < ctx->frame_len-2; i++) {
         uint8_t b = ctx->buf[i];
-        if (b == FEND) {
-            fputc(FESC, &serial->uart0);
-            fputc(TFEND, &serial->uart0);
-        } else if (b == FESC) {
-            fputc(FESC, &serial->uart0);
-            fputc(TFESC, &serial->uart0);
-        } else {
-            fputc(b, &serial->uart0);
+        if (crcMode != CRC_MODE_NONE) crc = kiss_updateCrc(crcMode, b, crc);
+        kiss_putEscaped(b);
+    }
+
+    if (crcMode == CRC_MODE_SMACK) {
+        kiss_putEscaped(crc & 0xFF);
+        kiss_putEscaped(crc >> 8);
+    } else if (crcMode == CRC_MODE_FLEXNET) {
+        kiss_putEscaped(crc >> 8);
+        kiss_putEscaped(crc & 0xFF);
+    }
+    serial_write(FEND);
+
+    if (rxInfo) kiss_sendRxInfo(&ctx->info);
+}
+
+static bool kiss_checkCrc(void) {
+    // Once the host has started using a CRC mode,
+    // we only accept data and ACKMODE frames
+    // protected by it
+    if (frameCrcMode == CRC_MODE_NONE) return (crcMode == CRC_MODE_NONE);
+    if (frame_len < 2) return false;
+
+    if (frameCrcMode == CRC_MODE_SMACK && frameCrc != SMACK_CRC_CORRECT) return false;
+    if (frameCrcMode == CRC_MODE_FLEXNET && frameCrc != CRC_FLEX_CORRECT) return false;
+
+    // The frame checks out, so we strip the CRC and
+    // switch our own output to the same CRC mode
+    frame_len -= 2;
+    crcMode = frameCrcMode;
+    return true;
+}
+
+static void kiss_hwReply(uint8_t *buf, size_t len) {
+    serial_write(FEND);
+    serial_write(CMD_SETHARDWARE);
+    while (len--) kiss_putEscaped(*buf++);
+    serial_write(FEND);
+}
+
+static uint16_t kiss_getParam(uint8_t param) {
+    if (param == PARAM_TXDELAY) return custom_preamble;
+    if (param == PARAM_P) return p;
+    if (param == PARAM_SLOTTIME) return slotTime;
+    if (param == PARAM_TXTAIL) return custom_tail;
+    if (param == PARAM_FULLDUPLEX) return channel->fullDuplex;
+    if (param == PARAM_FLOWCONTROL) return FLOWCONTROL;
+    if (param == PARAM_DIGIPEATER) return digi.enabled;
+    if (param == PARAM_DIGI_HOPS) return digi.max_hops;
+    if (param == PARAM_ADAPTIVE_CSMA) return adaptiveCsma;
+    if (param == PARAM_RX_INFO) return rxInfo;
+    if (param == PARAM_FLEXNET) return flexnet;
+    return 0;
+}
+
+static bool kiss_setParam(uint8_t param, uint16_t value) {
+    if (param == PARAM_TXDELAY) {
+        custom_preamble = value;
+    } else if (param == PARAM_P) {
+        p = value;
+    } else if (param == PARAM_SLOTTIME) {
+        slotTime = value;
+    } else if (param == PARAM_TXTAIL) {
+        custom_tail = value;
+    } else if (param == PARAM_FULLDUPLEX) {
+        channel->fullDuplex = (value != 0);
+    } else if (param == PARAM_FLOWCONTROL) {
+        FLOWCONTROL = (value != 0);
+    } else if (param == PARAM_DIGIPEATER) {
+        digi.enabled = (value != 0);
+    } else if (param == PARAM_DIGI_HOPS && value <= 7) {
+        digi.max_hops = value;
+    } else if (param == PARAM_ADAPTIVE_CSMA) {
+        adaptiveCsma = (value != 0);
+    } else if (param == PARAM_RX_INFO) {
+        rxInfo = (value != 0);
+    } else if (param == PARAM_FLEXNET) {
+        flexnet = (value != 0);
+        if (!flexnet && crcMode == CRC_MODE_FLEXNET) crcMode = CRC_MODE_NONE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static uint8_t *kiss_putLong(uint8_t *ptr, uint32_t value) {
+    *ptr++ = value >> 24;
+    *ptr++ = value >> 16;
+    *ptr++ = value >> 8;
+    *ptr++ = value;
+    return ptr;
+}
+
+// Sends the receive metadata of a frame to the host,
+// right after the frame itself
+static void kiss_sendRxInfo(const HdlcFrameInfo *info) {
+    uint8_t buf[12];
+    uint8_t *ptr = buf;
+    *ptr++ = HW_RX_INFO;
+    ptr = kiss_putLong(ptr, info->start);
+    *ptr++ = info->peak;
+    *ptr++ = afsk_frameLevel(info);
+    *ptr++ = info->drift >> 8;
+    *ptr++ = info->drift;
+    *ptr++ = info->edges >> 8;
+    *ptr++ = info->edges;
+    *ptr++ = afsk_frameJitter(info);
+    kiss_hwReply(buf, ptr - buf);
+}
+
+static void kiss_hwCommand(uint8_t *buf, size_t len) {
+    // Replies are written into the front of the
+    // serial buffer, since we are done with the
+    // command data by the time they are assembled.
+    if (len == 0) return;
+    uint8_t subcommand = buf[0];
+    uint8_t *ptr = buf + 1;
+
+    if ((subcommand == HW_GET_PARAM && len >= 2) ||
+        (subcommand == HW_SET_PARAM && len >= 4)) {
+        uint8_t param = buf[1];
+        if (subcommand == HW_SET_PARAM && !kiss_setParam(param, (buf[2] << 8) | buf[3])) return;
+        uint16_t value = kiss_getParam(param);
+        ptr++;
+        *ptr++ = value >> 8;
+        *ptr++ = value;
+    } else if (subcommand == HW_SAVE_PARAMS) {
+        kiss_saveSettings();
+        *ptr++ = 0x01;
+    } else if (subcommand == HW_LOAD_PARAMS) {
+        *ptr++ = kiss_loadSettings() ? 0x01 : 0x00;
+    } else if (subcommand == HW_CLEAR_PARAMS) {
+        kiss_clearSettings();
+        *ptr++ = 0x01;
+    } else if (subcommand == HW_GET_STATS) {
+        Stats snapshot;
+        stats_snapshot(&snapshot);
+        ptr = kiss_putLong(ptr, snapshot.rx_frames);
+        ptr = kiss_putLong(ptr, snapshot.tx_frames);
+        ptr = kiss_putLong(ptr, snapshot.crc_errors);
+        ptr = kiss_putLong(ptr, snapshot.rx_overruns);
+        ptr = kiss_putLong(ptr, snapshot.dcd_ticks);
+        ptr = kiss_putLong(ptr, timer_clock() - snapshot.epoch);
+        ptr = kiss_putLong(ptr, snapshot.flags);
+        ptr = kiss_putLong(ptr, snapshot.frames_started);
+        ptr = kiss_putLong(ptr, snapshot.tx_ticks);
+        ptr = kiss_putLong(ptr, snapshot.isr_max);
+        ptr = kiss_putLong(ptr, snapshot.idle_ticks);
+        ptr = kiss_putLong(ptr, snapshot.digi_dropped);
+    } else if (subcommand == HW_RESET_STATS) {
+        stats_reset();
+        *ptr++ = 0x01;
+    } else if (subcommand == HW_GET_RAM) {
+        uint16_t freeNow = ram_free();
+        uint16_t minFree = ram_minFree();
+        *ptr++ = freeNow >> 8;
+        *ptr++ = freeNow;
+        *ptr++ = minFree >> 8;
+        *ptr++ = minFree;
+    } else if (subcommand == HW_GET_HEARD) {
+        ticks_t now = timer_clock();
+        *ptr++ = heard_count();
+        const HeardEntry *entry;
+        for (uint8_t n = 0; (entry = heard_get(n)) != NULL; n++) {
+            memcpy(ptr, entry->call, sizeof(entry->call));
+            ptr += sizeof(entry->call);
+            ptr = kiss_putLong(ptr, now - entry->last);
+            *ptr++ = entry->count >> 8;
+            *ptr++ = entry->count;
+            *ptr++ = entry->direct;
+            *ptr++ = entry->level;
         }
+    } else if (subcommand == HW_GET_DCD) {
+        *ptr++ = channel->carrier;
+        *ptr++ = channel->dcdQuality;
+        *ptr++ = channel->dcdLevel;
+        *ptr++ = channel->hdlc.dcd;
+    } else if (subcommand == HW_GET_LOAD) {
+        *ptr++ = load_get();
+        *ptr++ = load_persistence(p);
+        unsigned long slot = load_slotTime(slotTime);
+        *ptr++ = slot >> 8;
+        *ptr++ = slot;
+    } else if (subcommand == HW_GET_DIGI_CALL ||
+               (subcommand == HW_SET_DIGI_CALL && len >= 1 + sizeof(digi.call))) {
+        if (subcommand == HW_SET_DIGI_CALL) memcpy(digi.call, buf + 1, sizeof(digi.call));
+        memcpy(ptr, digi.call, sizeof(digi.call));
+        ptr += sizeof(digi.call);
+    } else if ((subcommand == HW_GET_DIGI_ALIAS && len >= 2) ||
+               (subcommand == HW_SET_DIGI_ALIAS && len >= 2 + sizeof(digi.aliases[0]))) {
+        uint8_t index = buf[1];
+        if (index >= CONFIG_DIGI_ALIASES) return;
+        if (subcommand == HW_SET_DIGI_ALIAS) memcpy(digi.aliases[index], buf + 2, sizeof(digi.aliases[0]));
+        ptr++;
+        memcpy(ptr, digi.aliases[index], sizeof(digi.aliases[0]));
+        ptr += sizeof(digi.aliases[0]);
+    } else if ((subcommand == HW_GET_FILTER && len >= 2) ||
+               (subcommand == HW_SET_FILTER && len >= 2 + sizeof(FilterRule))) {
+        uint8_t index = buf[1];
+        FilterRule rule;
+        if (subcommand == HW_SET_FILTER) {
+            memcpy(&rule, buf + 2, sizeof(rule));
+            if (!filter_set(index, &rule)) return;
+        }
+        if (!filter_get(index, &rule)) return;
+        ptr++;
+        memcpy(ptr, &rule, sizeof(rule));
+        ptr += sizeof(rule);
+    } else if (subcommand == HW_CLEAR_FILTERS) {
+        filter_clear();
+        *ptr++ = 0x01;
+    } else if (subcommand == HW_GET_CALIBRATION ||
+               (subcommand == HW_CALIBRATE && len >= 2) ||
+               (subcommand == HW_SET_CLOCK_TRIM && len >= 2)) {
+        if (subcommand == HW_CALIBRATE) {
+            if (buf[1]) calibration_start(); else calibration_stop();
+        } else if (subcommand == HW_SET_CLOCK_TRIM) {
+            calibration_setTrim(buf[1]);
+        }
+        *ptr++ = calibration.active;
+        *ptr++ = calibration.frames;
+        *ptr++ = calibration.trim;
+    } else {
+        return;
+    }
+
+    kiss_hwReply(buf, ptr - buf);
+}
+
+static void kiss_ready(void) {
+    if (FLOWCONTROL) {
+        static const uint8_t ready[] = { FEND, CMD_READY, 0x01, FEND };
+        serial_writeSpan(ready, sizeof(ready));
+    }
+}
+
+static void kiss_ack(const uint8_t *seq) {
+    serial_write(FEND);
+    serial_write(CMD_ACKMODE);
+    kiss_putEscaped(seq[0]);
+    kiss_putEscaped(seq[1]);
+    serial_write(FEND);
+}
+
+// Tells the host that one of its frames was dropped
+// instead of being sent. A flow controlled host gets
+// READY just like for a sent frame, and the TX_DROPPED
+// frame says why. For an ACKMODE frame, it carries the
+// sequence ID in place of the ack.
+static void kiss_dropped(uint8_t flags, const uint8_t *seq, uint8_t reason) {
+    if (!(flags & TX_FROM_HOST)) return;
+
+    uint8_t buf[4];
+    uint8_t *ptr = buf;
+    *ptr++ = HW_TX_DROPPED;
+    *ptr++ = reason;
+    if (flags & TX_ACK) {
+        *ptr++ = seq[0];
+        *ptr++ = seq[1];
     }
-    fputc(FEND, &serial->uart0);
+    kiss_hwReply(buf, ptr - buf);
+    kiss_ready();
+}
+
+static void kiss_txDone(void) {
+    TxFrame *frame = &txQueue[txHead];
+    pool_put(frame->buf);
+    txHead = (txHead + 1) % KISS_TX_QUEUE;
+    txCount--;
+    if (txCount > 0) sched_after(0, kiss_csmaTask);
 }
 
-void kiss_csma(AX25Ctx *ctx, uint8_t *buf, size_t len) {
-    bool sent = false;
-    if (CONFIG_AFSK_TXWAIT > 0) {
-        ticks_t wait_start = timer_clock();
-        long wait_ticks = ms_to_ticks(CONFIG_AFSK_TXWAIT);
-        while (timer_clock() - wait_start < wait_ticks) {
-            cpu_relax();
+// Channel access for the frame at the head of the
+// transmit queue, using p-persistent CSMA. Instead of
+// waiting, the task schedules itself to try again, so
+// the main loop keeps running in the meantime.
+static void kiss_csmaTask(void) {
+    if (txCount == 0) return;
+    TxFrame *frame = &txQueue[txHead];
+
+    if (frame->sent) {
+        // The sequence ID of an ACKMODE frame is only
+        // echoed back once the frame has actually left
+        // the modem
+        if (channel->sending) {
+            sched_after(0, kiss_csmaTask);
+            return;
         }
+        if (frame->flags & TX_ACK) kiss_ack(frame->ackSeq);
+        kiss_txDone();
+        return;
     }
-    while (!sent) {
-        //puts("Waiting in CSMA");
-        if(!channel->hdlc.dcd) {
-            uint8_t tp = rand() & 0xFF;
-            if (tp < p) {
-                ax25_sendRaw(ctx, buf, len);
-                sent = true;
+
+    // In full-duplex mode there is no channel
+    // access to arbitrate, so we transmit the
+    // frame immediately.
+    if (!channel->fullDuplex) {
+        // The channel is busy as soon as the signal
+        // looks like packet data, before any HDLC
+        // flags have been decoded
+        if (channel->hdlc.dcd || channel->carrier) {
+            if (channel->status != 0) {
+                // If an overflow or other error
+                // occurs, we'll back off and drop
+                // this packet.
+                channel->status = 0;
+                kiss_dropped(frame->flags, frame->ackSeq, DROP_CHANNEL);
+                kiss_txDone();
             } else {
-                ticks_t start = timer_clock();
-                long slot_ticks = ms_to_ticks(slotTime);
-                while (timer_clock() - start < slot_ticks) {
-                    cpu_relax();
-                }
-            }
-        } else {
-            while (!sent && channel->hdlc.receiving) {
-                // Continously poll the modem for data
-                // while waiting, so we don't overrun
-                // receive buffers
-                ax25_poll(ax25ctx);
-
-                if (channel->status != 0) {
-                    // If an overflow or other error
-                    // occurs, we'll back off and drop
-                    // this packet silently.
-                    channel->status = 0;
-                    sent = true;
-                }
+                sched_after(0, kiss_csmaTask);
             }
+            return;
+        }
+
+        // With adaptive CSMA, the persistence and slot
+        // time follow the measured channel load
+        uint8_t persistence = adaptiveCsma ? load_persistence(p) : p;
+        uint8_t tp = rand() & 0xFF;
+        if (tp >= persistence) {
+            unsigned long slot = adaptiveCsma ? load_slotTime(slotTime) : slotTime;
+            sched_after(ms_to_ticks(slot), kiss_csmaTask);
+            return;
         }
     }
 
-    if (FLOWCONTROL) {
-        while (!ctx->ready_for_data) { /* Wait */ }
-        fputc(FEND, &serial->uart0);
-        fputc(CMD_READY, &serial->uart0);
-        fputc(0x01, &serial->uart0);
-        fputc(FEND, &serial->uart0);
+    ax25_sendRaw(ax25ctx, frame->buf, frame->len);
+    frame->sent = true;
+    if (frame->flags & TX_FROM_HOST) kiss_ready();
+    sched_after(0, kiss_csmaTask);
+}
+
+// Queues a frame for transmission, and takes over the
+// pool block holding it. Returns false if the queue is
+// full, and the caller keeps the block.
+bool kiss_queue(uint8_t *buf, size_t len, uint8_t flags) {
+    if (buf == NULL || txCount == KISS_TX_QUEUE) return false;
+
+    TxFrame *frame = &txQueue[(txHead + txCount) % KISS_TX_QUEUE];
+    frame->buf = buf;
+    frame->len = len;
+    frame->flags = flags;
+    frame->sent = false;
+    if (flags & TX_ACK) memcpy(frame->ackSeq, ackSeq, sizeof(ackSeq));
+
+    if (txCount++ == 0) {
+        ticks_t wait = channel->fullDuplex ? 0 : ms_to_ticks(CONFIG_AFSK_TXWAIT);
+        sched_after(wait, kiss_csmaTask);
     }
+    return true;
+}
+
+static void kiss_releaseBuffer(void) {
+    pool_put(serialBuffer);
+    serialBuffer = NULL;
 }
 
 void kiss_serialCallback(uint8_t sbyte) {
     if (IN_FRAME && sbyte == FEND && command == CMD_DATA) {
         IN_FRAME = false;
-        kiss_csma(ax25ctx, serialBuffer, frame_len);
+        // The frame buffer is handed over to the
+        // transmit queue, and returned to the pool
+        // once the frame has been sent
+        if (TOO_LONG) {
+            kiss_dropped(TX_FROM_HOST, NULL, DROP_TOO_LONG);
+        } else if (!kiss_checkCrc()) {
+            kiss_dropped(TX_FROM_HOST, NULL, DROP_CRC);
+        } else if (frame_len == 0) {
+            kiss_dropped(TX_FROM_HOST, NULL, DROP_EMPTY);
+        } else if (kiss_queue(serialBuffer, frame_len, TX_FROM_HOST)) {
+            serialBuffer = NULL;
+        } else {
+            kiss_dropped(TX_FROM_HOST, NULL, DROP_QUEUE_FULL);
+        }
+        kiss_releaseBuffer();
+    } else if (IN_FRAME && sbyte == FEND && command == CMD_ACKMODE) {
+        IN_FRAME = false;
+        if (ackLen == 2 && TOO_LONG) {
+            kiss_dropped(TX_FROM_HOST | TX_ACK, ackSeq, DROP_TOO_LONG);
+        } else if (ackLen == 2 && !kiss_checkCrc()) {
+            kiss_dropped(TX_FROM_HOST | TX_ACK, ackSeq, DROP_CRC);
+        } else if (ackLen == 2 && frame_len == 0) {
+            kiss_dropped(TX_FROM_HOST | TX_ACK, ackSeq, DROP_EMPTY);
+        } else if (ackLen == 2 && kiss_queue(serialBuffer, frame_len, TX_FROM_HOST | TX_ACK)) {
+            serialBuffer = NULL;
+        } else if (ackLen == 2) {
+            kiss_dropped(TX_FROM_HOST | TX_ACK, ackSeq, DROP_QUEUE_FULL);
+        } else {
+            kiss_ready();
+        }
+        kiss_releaseBuffer();
+    } else if (IN_FRAME && sbyte == FEND && command == CMD_SETHARDWARE) {
+        IN_FRAME = false;
+        if (!TOO_LONG) kiss_hwCommand(serialBuffer, frame_len);
+        kiss_releaseBuffer();
     } else if (sbyte == FEND) {
         IN_FRAME = true;
         command = CMD_UNKNOWN;
         frame_len = 0;
-    } else if (IN_FRAME && frame_len < AX25_MAX_FRAME_LEN) {
+        ackLen = 0;
+        TOO_LONG = false;
+    } else if (IN_FRAME) {
         // Have a look at the command byte first
         if (frame_len == 0 && command == CMD_UNKNOWN) {
+            // Check whether this is a CRC protected
+            // SMACK data or ACKMODE frame, or a FlexNet
+            // data frame. Without the FLEXNET parameter,
+            // command 0x20 is a plain data frame for
+            // port 2, as in standard KISS.
+            if ((sbyte & 0x8F) == CMD_SMACK_DATA || (sbyte & 0x8F) == CMD_SMACK_ACKMODE) {
+                frameCrcMode = CRC_MODE_SMACK;
+                frameCrc = kiss_updateCrc(frameCrcMode, sbyte, SMACK_CRC_INIT_VAL);
+            } else if (sbyte == CMD_FLEXNET_DATA && flexnet) {
+                frameCrcMode = CRC_MODE_FLEXNET;
+                frameCrc = kiss_updateCrc(frameCrcMode, sbyte, CRC_FLEX_INIT_VAL);
+            } else {
+                frameCrcMode = CRC_MODE_NONE;
+            }
+
             // MicroModem supports only one HDLC port, so we
             // strip off the port nibble of the command byte
             sbyte = sbyte & 0x0F;
             command = sbyte;
-        } else if (command == CMD_DATA) {
+        } else if (command == CMD_DATA || command == CMD_ACKMODE || command == CMD_SETHARDWARE) {
             if (sbyte == FESC) {
                 ESCAPE = true;
             } else {
@@ -129,7 +600,32 @@ void kiss_serialCallback(uint8_t sbyte) {
                     if (sbyte == TFESC) sbyte = FESC;
                     ESCAPE = false;
                 }
-                serialBuffer[frame_len++] = sbyte;
+                // ACKMODE frames carry a two byte sequence
+                // ID in front of the actual frame data
+                if (command == CMD_ACKMODE && ackLen < 2) {
+                    if (frameCrcMode != CRC_MODE_NONE) frameCrc = kiss_updateCrc(frameCrcMode, sbyte, frameCrc);
+                    ackSeq[ackLen++] = sbyte;
+                } else {
+                    // A frame longer than a block is read to
+                    // the end, and dropped there
+                    if (frame_len == AX25_MAX_FRAME_LEN) {
+                        TOO_LONG = true;
+                        return;
+                    }
+                    // Take a block from the frame pool for
+                    // the first data byte. If none are free,
+                    // the rest of the frame is ignored, and
+                    // the host is told its frame was dropped.
+                    if (serialBuffer == NULL) serialBuffer = pool_get();
+                    if (serialBuffer == NULL) {
+                        IN_FRAME = false;
+                        if (command == CMD_DATA) kiss_dropped(TX_FROM_HOST, NULL, DROP_NO_BUFFER);
+                        if (command == CMD_ACKMODE) kiss_dropped(TX_FROM_HOST | TX_ACK, ackSeq, DROP_NO_BUFFER);
+                        return;
+                    }
+                    if (frameCrcMode != CRC_MODE_NONE) frameCrc = kiss_updateCrc(frameCrcMode, sbyte, frameCrc);
+                    serialBuffer[frame_len++] = sbyte;
+                }
             }
         } else if (command == CMD_TXDELAY) {
             custom_preamble = sbyte * 10UL;
@@ -139,6 +635,8 @@ void kiss_serialCallback(uint8_t sbyte) {
             slotTime = sbyte * 10;
         } else if (command == CMD_P) {
             p = sbyte;
+        } else if (command == CMD_FULLDUPLEX) {
+            channel->fullDuplex = (sbyte != 0x00);
         } else if (command == CMD_READY) {
             if (sbyte == 0x00) {
                 FLOWCONTROL = false;
@@ -148,4 +646,5 @@ void kiss_serialCallback(uint8_t sbyte) {
         }
         
     }
-}
\ No newline at end of file
+}
+#endif
@@ -25,12 +25,152 @@
 #define CMD_TXTAIL 0x04
 #define CMD_FULLDUPLEX 0x05
 #define CMD_SETHARDWARE 0x06
+#define CMD_ACKMODE 0x0C
 #define CMD_READY 0x0F
 #define CMD_RETURN 0xFF
 
-void kiss_init(AX25Ctx *ax25, Afsk *afsk, Serial *ser);
-void kiss_csma(AX25Ctx *ctx, uint8_t *buf, size_t len);
+// CRC protected KISS variants. SMACK sets the high bit
+// of the command byte on data and ACKMODE frames and
+// appends a CRC-16, low byte first, which also covers
+// the ACKMODE sequence ID. FlexNet uses command 0x20 for
+// data frames and appends its own CRC, high byte first.
+// Command 0x20 is only taken as FlexNet when the FLEXNET
+// parameter is set, since it is also a port 2 data frame.
+#define CMD_SMACK_DATA 0x80
+#define CMD_SMACK_ACKMODE (CMD_SMACK_DATA | CMD_ACKMODE)
+#define CMD_FLEXNET_DATA 0x20
+
+#define CRC_MODE_NONE 0x00
+#define CRC_MODE_SMACK 0x01
+#define CRC_MODE_FLEXNET 0x02
+
+#define SMACK_CRC_INIT_VAL 0x0000
+#define SMACK_CRC_CORRECT 0x0000
+
+// SETHARDWARE sub-commands. The first data byte of a
+// SETHARDWARE frame selects the sub-command, and the
+// modem replies with a SETHARDWARE frame starting with
+// the same sub-command. Multi-byte values are sent
+// most significant byte first.
+//
+// GET_PARAM   <param>              -> <param> <value:2>
+// SET_PARAM   <param> <value:2>    -> <param> <value:2>
+// SAVE_PARAMS                      -> <1 = ok, 0 = failed>
+// LOAD_PARAMS                      -> <1 = ok, 0 = failed>
+// CLEAR_PARAMS                     -> <1 = ok, 0 = failed>
+// GET_STATS                        -> <rx frames:4> <tx frames:4>
+//                                     <crc errors:4> <rx overruns:4>
+//                                     <dcd ticks:4> <elapsed ticks:4>
+//                                     <flags:4> <frames started:4>
+//                                     <tx ticks:4> <max isr cycles:4>
+//                                     <idle ticks:4> <digi dropped:4>
+// RESET_STATS                      -> <1>
+// GET_RAM                          -> <free bytes:2> <min free bytes:2>
+// GET_DIGI_CALL                    -> <call:7>
+// SET_DIGI_CALL <call:7>           -> <call:7>
+// GET_DIGI_ALIAS <index>           -> <index> <alias:7>
+// SET_DIGI_ALIAS <index> <alias:7> -> <index> <alias:7>
+// GET_HEARD                        -> <count> followed by, for each
+//                                     station, most recent first:
+//                                     <call:7> <age ticks:4>
+//                                     <packets:2> <direct> <level>
+// GET_DCD                          -> <carrier> <quality> <level>
+//                                     <hdlc dcd>
+// GET_LOAD                         -> <load> <adaptive p>
+//                                     <adaptive slot time:2>
+// RX_INFO (sent by the modem)      -> <start ticks:4> <peak level>
+//                                     <average level> <drift:2>
+//                                     <transitions:2> <jitter>
+// TX_DROPPED (sent by the modem)   -> <reason> [<sequence ID:2>]
+// GET_FILTER  <index>              -> <index> <type> <value:7>
+// SET_FILTER  <index> <type> <value:7>
+//                                  -> <index> <type> <value:7>
+// CLEAR_FILTERS                    -> <1>
+// CALIBRATE <1 = start, 0 = stop>  -> <running> <frames> <trim>
+// GET_CALIBRATION                  -> <running> <frames> <trim>
+// SET_CLOCK_TRIM <trim>            -> <running> <frames> <trim>
+//
+// Filter rules are described in Filter.h, and setting
+// a rule of type 0 removes it. Digipeater callsigns are
+// described in Digi.h, and setting an alias with an
+// empty callsign removes it. The filter table and the
+// digipeater settings are saved and loaded along with
+// the parameters. The sample clock calibration is
+// described in Calibration.h, and the carrier detector
+// and its quality figure in device.h. The trim is a
+// signed byte, and is saved to EEPROM as soon as it
+// changes. The channel load and the adaptive CSMA
+// values are described in Load.h, and the adaptive
+// values are reported whether adaptive CSMA is on or
+// not. While the RX_INFO parameter is set, each data
+// frame sent to the host is followed by an RX_INFO
+// frame with its receive metadata, described in
+// AFSK.h. The drift is signed, and the jitter is in
+// 1/256 of a bit.
+//
+// When a frame from the host is dropped instead of
+// transmitted, the modem sends a TX_DROPPED frame with
+// one of the reasons below. For ACKMODE frames, the
+// sequence ID follows it, and no ack is sent. A flow
+// controlled host also gets READY, as for a sent frame.
+#define HW_GET_PARAM 0x01
+#define HW_SET_PARAM 0x02
+#define HW_SAVE_PARAMS 0x03
+#define HW_LOAD_PARAMS 0x04
+#define HW_CLEAR_PARAMS 0x05
+#define HW_GET_STATS 0x10
+#define HW_RESET_STATS 0x11
+#define HW_GET_RAM 0x12
+#define HW_GET_DIGI_CALL 0x13
+#define HW_SET_DIGI_CALL 0x14
+#define HW_GET_DIGI_ALIAS 0x15
+#define HW_SET_DIGI_ALIAS 0x16
+#define HW_GET_HEARD 0x17
+#define HW_GET_DCD 0x18
+#define HW_GET_LOAD 0x19
+#define HW_RX_INFO 0x1A
+#define HW_TX_DROPPED 0x1B
+#define HW_GET_FILTER 0x20
+#define HW_SET_FILTER 0x21
+#define HW_CLEAR_FILTERS 0x22
+#define HW_CALIBRATE 0x30
+#define HW_GET_CALIBRATION 0x31
+#define HW_SET_CLOCK_TRIM 0x32
+
+#define DROP_QUEUE_FULL 0x01     // The transmit queue was full
+#define DROP_CHANNEL 0x02        // Receive error while waiting for the channel
+#define DROP_CRC 0x03            // Missing or wrong SMACK or FlexNet CRC
+#define DROP_NO_BUFFER 0x04      // No free frame buffer to read it into
+#define DROP_TOO_LONG 0x05       // Longer than AX25_MAX_FRAME_LEN bytes
+#define DROP_EMPTY 0x06          // The frame held no data to send
+
+// Parameter IDs follow the KISS command numbers. Time
+// values are in milliseconds, not 10ms KISS units.
+#define PARAM_TXDELAY CMD_TXDELAY
+#define PARAM_P CMD_P
+#define PARAM_SLOTTIME CMD_SLOTTIME
+#define PARAM_TXTAIL CMD_TXTAIL
+#define PARAM_FULLDUPLEX CMD_FULLDUPLEX
+#define PARAM_FLOWCONTROL CMD_READY
+#define PARAM_DIGIPEATER 0x10
+#define PARAM_DIGI_HOPS 0x11
+#define PARAM_ADAPTIVE_CSMA 0x12
+#define PARAM_RX_INFO 0x13
+#define PARAM_FLEXNET 0x14
+
+void kiss_init(AX25Ctx *ax25, Afsk *afsk);
+// Flags for queued frames. Frames from the host get a
+// READY reply when flow control is on, and ACKMODE
+// frames get their sequence ID echoed once sent.
+#define TX_FROM_HOST 0x01
+#define TX_ACK 0x02
+
+bool kiss_queue(uint8_t *buf, size_t len, uint8_t flags);
 void kiss_messageCallback(AX25Ctx *ctx);
 void kiss_serialCallback(uint8_t sbyte);
 
+bool kiss_loadSettings(void);
+void kiss_saveSettings(void);
+void kiss_clearSettings(void);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,73 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+#include "Load.h"
+#include "util/sched.h"
+
+#define LOAD_BUCKET_TICKS CLOCK_TICKS_PER_SEC
+#define LOAD_WINDOW_TICKS ((uint32_t)LOAD_BUCKET_TICKS * CONFIG_LOAD_SECONDS)
+
+#if LOAD_BUCKET_TICKS > UINT16_MAX
+    #error Channel load buckets must fit in 16 bits!
+#endif
+
+static Afsk *modem;
+static uint16_t buckets[CONFIG_LOAD_SECONDS];   // Busy ticks in each second
+static uint8_t next;
+static uint16_t lastBusy;
+static uint32_t busySum;
+
+// The busy counter is updated by the sample interrupt,
+// so it is read twice like the clock.
+static uint16_t load_busyTicks(void) {
+    uint16_t result;
+    do {
+        result = modem->busyTicks;
+    } while (result != modem->busyTicks);
+
+    return result;
+}
+
+static void load_task(void) {
+    sched_after(LOAD_BUCKET_TICKS, load_task);
+
+    uint16_t busy = load_busyTicks();
+    uint16_t delta = busy - lastBusy;
+    lastBusy = busy;
+
+    busySum -= buckets[next];
+    busySum += delta;
+    buckets[next] = delta;
+    if (++next == CONFIG_LOAD_SECONDS) next = 0;
+}
+
+void load_init(Afsk *afsk) {
+    modem = afsk;
+    lastBusy = load_busyTicks();
+    sched_after(LOAD_BUCKET_TICKS, load_task);
+}
+
+uint8_t load_get(void) {
+    // The task can run a little late, so a bucket may
+    // hold slightly more than a second of busy time
+    uint32_t load = busySum * 255 / LOAD_WINDOW_TICKS;
+    return (load > 255) ? 255 : load;
+}
+
+// The chance of transmitting in a free slot goes down
+// in proportion to the load, since a busy channel means
+// more stations are waiting for it to clear.
+uint8_t load_persistence(uint8_t p) {
+    if (p <= CONFIG_LOAD_MIN_P) return p;
+    uint8_t adjusted = ((uint16_t)p * (256 - load_get())) >> 8;
+    return (adjusted < CONFIG_LOAD_MIN_P) ? CONFIG_LOAD_MIN_P : adjusted;
+}
+
+// Slots grow to up to three times the configured time
+// on a fully loaded channel, spreading retries out.
+unsigned long load_slotTime(unsigned long slotTime) {
+    return slotTime + slotTime * load_get() / 128;
+}
@@ -0,0 +1,29 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+#ifndef PROTOCOL_LOAD_H
+#define PROTOCOL_LOAD_H
+
+#include <stdint.h>
+#include "device.h"
+#include "hardware/AFSK.h"
+
+// Channel load measurement. Once a second, a scheduled
+// task adds up the sample ticks where the modem saw a
+// carrier or HDLC flags, and the load is the busy share
+// of the last CONFIG_LOAD_SECONDS seconds, from 0 for
+// an idle channel to 255 for a channel that was busy
+// all the time.
+//
+// For adaptive CSMA, the configured persistence and
+// slot time are taken as the values for an idle
+// channel, and are adjusted for the measured load.
+void load_init(Afsk *afsk);
+uint8_t load_get(void);
+uint8_t load_persistence(uint8_t p);
+unsigned long load_slotTime(unsigned long slotTime);
+
+#endif
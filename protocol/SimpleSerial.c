@@ -17,6 +17,15 @@
 #include "hardware/Serial.h"
 #include "SimpleSerial.h"
 #include "util/time.h"
+#include "util/stats.h"
+#include "util/ram.h"
+#include "util/sched.h"
+#include "util/settings.h"
+#include "Filter.h"
+#include "Digi.h"
+#include "Heard.h"
+#include "Load.h"
+#include "hardware/Calibration.h"
 
 #define countof(a) sizeof(a)/sizeof(a[0])
 
@@ -25,6 +34,7 @@ bool PRINT_DST = true;
 bool PRINT_PATH = true;
 bool PRINT_DATA = true;
 bool PRINT_INFO = true;
+bool PRINT_RXINFO = false;
 bool VERBOSE = true;
 bool SILENT = false;
 bool SS_INIT = false;
@@ -47,32 +57,50 @@ int PATH2_SSID = 2;
 AX25Call path[4];
 AX25Ctx *ax25ctx;
 
-#define NV_MAGIC_BYTE 0x69
-uint8_t EEMEM nvMagicByte;
-uint8_t EEMEM nvCALL[6];
-uint8_t EEMEM nvDST[6];
-uint8_t EEMEM nvPATH1[6];
-uint8_t EEMEM nvPATH2[6];
-uint8_t EEMEM nvCALL_SSID;
-uint8_t EEMEM nvDST_SSID;
-uint8_t EEMEM nvPATH1_SSID;
-uint8_t EEMEM nvPATH2_SSID;
-bool EEMEM nvPRINT_SRC;
-bool EEMEM nvPRINT_DST;
-bool EEMEM nvPRINT_PATH;
-bool EEMEM nvPRINT_DATA;
-bool EEMEM nvPRINT_INFO;
-bool EEMEM nvVERBOSE;
-bool EEMEM nvSILENT;
-uint8_t EEMEM nvPOWER;
-uint8_t EEMEM nvHEIGHT;
-uint8_t EEMEM nvGAIN;
-uint8_t EEMEM nvDIRECTIVITY;
-uint8_t EEMEM nvSYMBOL_TABLE;
-uint8_t EEMEM nvSYMBOL;
-uint8_t EEMEM nvAUTOACK;
-int EEMEM nvPREAMBLE;
-int EEMEM nvTAIL;
+#define NV_MAGIC_BYTE 0x53
+
+// Before the NvLayout block, these settings were kept
+// in separate EEMEM variables in this file, starting
+// at the first EEPROM address. Depending on the
+// compiler version, avr-gcc placed them either in the
+// order they were defined, which is the order below,
+// or in reverse, so both are checked for.
+#define NV_LEGACY_MAGIC_BYTE 0x69
+
+typedef struct NvLegacy {
+    uint8_t magic;
+    char call[6];
+    char dst[6];
+    char path1[6];
+    char path2[6];
+    uint8_t callSsid;
+    uint8_t dstSsid;
+    uint8_t path1Ssid;
+    uint8_t path2Ssid;
+    bool printSrc;
+    bool printDst;
+    bool printPath;
+    bool printData;
+    bool printInfo;
+    bool verbose;
+    bool silent;
+    uint8_t power;
+    uint8_t height;
+    uint8_t gain;
+    uint8_t directivity;
+    uint8_t symbolTable;
+    uint8_t symbol;
+    uint8_t autoAck;
+    int16_t preamble;
+    int16_t tail;
+} NvLegacy;
+
+// Size of each NvLegacy field, in order
+static const uint8_t legacyFields[] PROGMEM = {
+    1, 6, 6, 6, 6, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 2, 2
+};
 
 // Location packet assembly fields
 char latitude[8];
@@ -114,42 +142,125 @@ void ss_init(AX25Ctx *ax25) {
 }
 
 void ss_clearSettings(void) {
-    eeprom_update_byte((void*)&nvMagicByte, 0xFF);
+    eeprom_update_byte((void*)&nv.serial.magic, 0xFF);
+    filter_clearSettings();
+    digi_clearSettings();
     if (VERBOSE) printf_P(PSTR("Configuration cleared. Restart to load defaults.\n"));
     if (!VERBOSE && !SILENT) printf_P(PSTR("1\n"));
 }
 
+// A callsign is one to six printable characters,
+// padded with zeroes
+static bool ss_legacyCall(const char *call) {
+    if (call[0] == 0) return false;
+    bool end = false;
+    for (uint8_t i = 0; i < 6; i++) {
+        if (call[i] == 0) {
+            end = true;
+        } else if (end || call[i] < '!' || call[i] > '~') {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool ss_readLegacy(NvLegacy *old) {
+    uint8_t raw[sizeof(NvLegacy)];
+    eeprom_read_block((void*)raw, (void*)0, sizeof(raw));
+
+    // Settings in another version of the new layout
+    // are never taken for old ones
+    if (raw[0] == NV_SIGNATURE) return false;
+
+    memcpy(old, raw, sizeof(raw));
+    if (old->magic == NV_LEGACY_MAGIC_BYTE && ss_legacyCall(old->call) && ss_legacyCall(old->dst)) return true;
+
+    // In reverse order, the last field comes first
+    uint8_t *dst = (uint8_t *)old;
+    uint8_t *src = raw + sizeof(raw);
+    for (uint8_t i = 0; i < sizeof(legacyFields); i++) {
+        uint8_t size = pgm_read_byte(&legacyFields[i]);
+        src -= size;
+        memcpy(dst, src, size);
+        dst += size;
+    }
+    return old->magic == NV_LEGACY_MAGIC_BYTE && ss_legacyCall(old->call) && ss_legacyCall(old->dst);
+}
+
+static void ss_storeSettings(void);
+
+// Settings saved in the old layout are converted once,
+// the first time the firmware starts after an upgrade.
+// Storing them writes the new layout over the old one.
+static void ss_migrateSettings(void) {
+    NvLegacy old;
+    if (settings_valid() || !ss_readLegacy(&old)) return;
+
+    memcpy(CALL, old.call, 6);
+    memcpy(DST, old.dst, 6);
+    memcpy(PATH1, old.path1, 6);
+    memcpy(PATH2, old.path2, 6);
+
+    CALL_SSID = old.callSsid;
+    DST_SSID = old.dstSsid;
+    PATH1_SSID = old.path1Ssid;
+    PATH2_SSID = old.path2Ssid;
+
+    PRINT_SRC = old.printSrc;
+    PRINT_DST = old.printDst;
+    PRINT_PATH = old.printPath;
+    PRINT_DATA = old.printData;
+    PRINT_INFO = old.printInfo;
+    VERBOSE = old.verbose;
+    SILENT = old.silent;
+
+    power = old.power;
+    height = old.height;
+    gain = old.gain;
+    directivity = old.directivity;
+    symbolTable = old.symbolTable;
+    symbol = old.symbol;
+    message_autoAck = old.autoAck;
+
+    custom_preamble = old.preamble;
+    custom_tail = old.tail;
+    ss_storeSettings();
+}
+
 void ss_loadSettings(void) {
-    uint8_t verification = eeprom_read_byte((void*)&nvMagicByte);
-    if (verification == NV_MAGIC_BYTE) {
-        eeprom_read_block((void*)CALL, (void*)nvCALL, 6);
-        eeprom_read_block((void*)DST, (void*)nvDST, 6);
-        eeprom_read_block((void*)PATH1, (void*)nvPATH1, 6);
-        eeprom_read_block((void*)PATH2, (void*)nvPATH2, 6);
-
-        CALL_SSID = eeprom_read_byte((void*)&nvCALL_SSID);
-        DST_SSID = eeprom_read_byte((void*)&nvDST_SSID);
-        PATH1_SSID = eeprom_read_byte((void*)&nvPATH1_SSID);
-        PATH2_SSID = eeprom_read_byte((void*)&nvPATH2_SSID);
-
-        PRINT_SRC = eeprom_read_byte((void*)&nvPRINT_SRC);
-        PRINT_DST = eeprom_read_byte((void*)&nvPRINT_DST);
-        PRINT_PATH = eeprom_read_byte((void*)&nvPRINT_PATH);
-        PRINT_DATA = eeprom_read_byte((void*)&nvPRINT_DATA);
-        PRINT_INFO = eeprom_read_byte((void*)&nvPRINT_INFO);
-        VERBOSE = eeprom_read_byte((void*)&nvVERBOSE);
-        SILENT = eeprom_read_byte((void*)&nvSILENT);
-
-        power = eeprom_read_byte((void*)&nvPOWER);
-        height = eeprom_read_byte((void*)&nvHEIGHT);
-        gain = eeprom_read_byte((void*)&nvGAIN);
-        directivity = eeprom_read_byte((void*)&nvDIRECTIVITY);
-        symbolTable = eeprom_read_byte((void*)&nvSYMBOL_TABLE);
-        symbol = eeprom_read_byte((void*)&nvSYMBOL);
-        message_autoAck = eeprom_read_byte((void*)&nvAUTOACK);
-
-        custom_preamble = eeprom_read_word((void*)&nvPREAMBLE);
-        custom_tail = eeprom_read_word((void*)&nvTAIL);
+    ss_migrateSettings();
+    if (settings_valid() && eeprom_read_byte((void*)&nv.serial.magic) == NV_MAGIC_BYTE) {
+        eeprom_read_block((void*)CALL, (void*)nv.serial.call, 6);
+        eeprom_read_block((void*)DST, (void*)nv.serial.dst, 6);
+        eeprom_read_block((void*)PATH1, (void*)nv.serial.path1, 6);
+        eeprom_read_block((void*)PATH2, (void*)nv.serial.path2, 6);
+
+        CALL_SSID = eeprom_read_byte((void*)&nv.serial.callSsid);
+        DST_SSID = eeprom_read_byte((void*)&nv.serial.dstSsid);
+        PATH1_SSID = eeprom_read_byte((void*)&nv.serial.path1Ssid);
+        PATH2_SSID = eeprom_read_byte((void*)&nv.serial.path2Ssid);
+
+        PRINT_SRC = eeprom_read_byte((void*)&nv.serial.printSrc);
+        PRINT_DST = eeprom_read_byte((void*)&nv.serial.printDst);
+        PRINT_PATH = eeprom_read_byte((void*)&nv.serial.printPath);
+        PRINT_DATA = eeprom_read_byte((void*)&nv.serial.printData);
+        PRINT_INFO = eeprom_read_byte((void*)&nv.serial.printInfo);
+        PRINT_RXINFO = eeprom_read_byte((void*)&nv.serial.printRxInfo);
+        VERBOSE = eeprom_read_byte((void*)&nv.serial.verbose);
+        SILENT = eeprom_read_byte((void*)&nv.serial.silent);
+
+        power = eeprom_read_byte((void*)&nv.serial.power);
+        height = eeprom_read_byte((void*)&nv.serial.height);
+        gain = eeprom_read_byte((void*)&nv.serial.gain);
+        directivity = eeprom_read_byte((void*)&nv.serial.directivity);
+        symbolTable = eeprom_read_byte((void*)&nv.serial.symbolTable);
+        symbol = eeprom_read_byte((void*)&nv.serial.symbol);
+        message_autoAck = eeprom_read_byte((void*)&nv.serial.autoAck);
+
+        custom_preamble = eeprom_read_word((void*)&nv.serial.preamble);
+        custom_tail = eeprom_read_word((void*)&nv.serial.tail);
+        filter_loadSettings();
+        digi_loadSettings();
 
         if (VERBOSE && SS_INIT) printf_P(PSTR("Configuration loaded\n"));
     } else {
@@ -159,43 +270,69 @@ void ss_loadSettings(void) {
     }
 }
 
-void ss_saveSettings(void) {
-    eeprom_update_block((void*)CALL, (void*)nvCALL, 6);
-    eeprom_update_block((void*)DST, (void*)nvDST, 6);
-    eeprom_update_block((void*)PATH1, (void*)nvPATH1, 6);
-    eeprom_update_block((void*)PATH2, (void*)nvPATH2, 6);
-
-    eeprom_update_byte((void*)&nvCALL_SSID, CALL_SSID);
-    eeprom_update_byte((void*)&nvDST_SSID, DST_SSID);
-    eeprom_update_byte((void*)&nvPATH1_SSID, PATH1_SSID);
-    eeprom_update_byte((void*)&nvPATH2_SSID, PATH2_SSID);
-
-    eeprom_update_byte((void*)&nvPRINT_SRC, PRINT_SRC);
-    eeprom_update_byte((void*)&nvPRINT_DST, PRINT_DST);
-    eeprom_update_byte((void*)&nvPRINT_PATH, PRINT_PATH);
-    eeprom_update_byte((void*)&nvPRINT_DATA, PRINT_DATA);
-    eeprom_update_byte((void*)&nvPRINT_INFO, PRINT_INFO);
-    eeprom_update_byte((void*)&nvVERBOSE, VERBOSE);
-    eeprom_update_byte((void*)&nvSILENT, SILENT);
-
-    eeprom_update_byte((void*)&nvPOWER, power);
-    eeprom_update_byte((void*)&nvHEIGHT, height);
-    eeprom_update_byte((void*)&nvGAIN, gain);
-    eeprom_update_byte((void*)&nvDIRECTIVITY, directivity);
-    eeprom_update_byte((void*)&nvSYMBOL_TABLE, symbolTable);
-    eeprom_update_byte((void*)&nvSYMBOL, symbol);
-    eeprom_update_byte((void*)&nvAUTOACK, message_autoAck);
-
-    eeprom_update_word((void*)&nvPREAMBLE, custom_preamble);
-    eeprom_update_word((void*)&nvTAIL, custom_tail);
-
-    eeprom_update_byte((void*)&nvMagicByte, NV_MAGIC_BYTE);
+static void ss_storeSettings(void) {
+    settings_stamp();
+    eeprom_update_block((void*)CALL, (void*)nv.serial.call, 6);
+    eeprom_update_block((void*)DST, (void*)nv.serial.dst, 6);
+    eeprom_update_block((void*)PATH1, (void*)nv.serial.path1, 6);
+    eeprom_update_block((void*)PATH2, (void*)nv.serial.path2, 6);
+
+    eeprom_update_byte((void*)&nv.serial.callSsid, CALL_SSID);
+    eeprom_update_byte((void*)&nv.serial.dstSsid, DST_SSID);
+    eeprom_update_byte((void*)&nv.serial.path1Ssid, PATH1_SSID);
+    eeprom_update_byte((void*)&nv.serial.path2Ssid, PATH2_SSID);
+
+    eeprom_update_byte((void*)&nv.serial.printSrc, PRINT_SRC);
+    eeprom_update_byte((void*)&nv.serial.printDst, PRINT_DST);
+    eeprom_update_byte((void*)&nv.serial.printPath, PRINT_PATH);
+    eeprom_update_byte((void*)&nv.serial.printData, PRINT_DATA);
+    eeprom_update_byte((void*)&nv.serial.printInfo, PRINT_INFO);
+    eeprom_update_byte((void*)&nv.serial.printRxInfo, PRINT_RXINFO);
+    eeprom_update_byte((void*)&nv.serial.verbose, VERBOSE);
+    eeprom_update_byte((void*)&nv.serial.silent, SILENT);
+
+    eeprom_update_byte((void*)&nv.serial.power, power);
+    eeprom_update_byte((void*)&nv.serial.height, height);
+    eeprom_update_byte((void*)&nv.serial.gain, gain);
+    eeprom_update_byte((void*)&nv.serial.directivity, directivity);
+    eeprom_update_byte((void*)&nv.serial.symbolTable, symbolTable);
+    eeprom_update_byte((void*)&nv.serial.symbol, symbol);
+    eeprom_update_byte((void*)&nv.serial.autoAck, message_autoAck);
+
+    eeprom_update_word((void*)&nv.serial.preamble, custom_preamble);
+    eeprom_update_word((void*)&nv.serial.tail, custom_tail);
+    filter_saveSettings();
+    digi_saveSettings();
+
+    eeprom_update_byte((void*)&nv.serial.magic, NV_MAGIC_BYTE);
+}
 
+void ss_saveSettings(void) {
+    ss_storeSettings();
     if (VERBOSE) printf_P(PSTR("Configuration saved\n"));
     if (!VERBOSE && !SILENT) printf_P(PSTR("1\n"));
 }
 
+// Message acks are sent a while after the message was
+// received, from a scheduled task, so reception goes on
+// while we wait
+static char pendingAck[20];      // Addressee, "ack" and sequence ID
+static size_t pendingAckLen;
+
+static void ss_sendAck(void) {
+    ss_sendPkt(pendingAck, pendingAckLen, ax25ctx);
+    pendingAckLen = 0;
+}
+
 void ss_messageCallback(struct AX25Msg *msg) {
+    // Receive metadata goes first, since the data at
+    // the end of the line can contain anything
+    if (PRINT_RXINFO) {
+        const HdlcFrameInfo *info = &ax25ctx->info;
+        if (PRINT_INFO) printf_P(PSTR("RX: "));
+        printf_P(PSTR("[%lu %u %u %d %u] "), (unsigned long)info->start, info->peak,
+            afsk_frameLevel(info), info->drift, afsk_frameJitter(info));
+    }
     if (PRINT_SRC) {
         if (PRINT_INFO) printf_P(PSTR("SRC: "));
         printf_P(PSTR("[%.6s-%d] "), msg->src.call, msg->src.ssid);
@@ -264,9 +401,12 @@ void ss_messageCallback(struct AX25Msg *msg) {
                 }
             }
 
-            if (msl != 0 && shouldAck) {
+            // Only one ack is held back at a time, so a
+            // message arriving while the previous ack is
+            // still pending is not acknowledged
+            if (msl != 0 && shouldAck && pendingAckLen == 0) {
                 int ii = 0;
-                char *ack = malloc(14+msl);
+                char *ack = pendingAck;
 
                 for (ii = 0; ii < 9; ii++) {
                     ack[1+ii] = ' ';
@@ -299,15 +439,74 @@ void ss_messageCallback(struct AX25Msg *msg) {
                     ack[14+ii] = mseq[ii+1];
                 }
 
-                delay_ms(1750);
-                ss_sendPkt(ack, 14+msl, ax25ctx);
-
-                free(ack);
+                pendingAckLen = 14+msl;
+                if (!sched_after(ms_to_ticks(1750), ss_sendAck)) pendingAckLen = 0;
             }
         }
     }
 }
 
+static bool ss_parseCall(uint8_t *call, uint8_t *buffer, size_t length, uint8_t ssid) {
+    // Parses a callsign with an optional SSID, like
+    // N0CALL-7, into six zero padded characters and
+    // the SSID. Without an SSID, the given one is used.
+    while (length > 0 && (buffer[length-1] == 10 || buffer[length-1] == 13)) length--;
+    if (length == 0) return false;
+
+    memset(call, 0, 6);
+    size_t count = 0;
+    while (count < length && count < 6 && buffer[count] != '-') {
+        call[count] = buffer[count];
+        count++;
+    }
+    if (count < length && buffer[count] == '-') {
+        ssid = 0;
+        for (count++; count < length; count++) {
+            if (buffer[count] < 48 || buffer[count] > 57) return false;
+            ssid = ssid*10 + buffer[count]-48;
+            if (ssid > 15) return false;
+        }
+    }
+    call[6] = ssid;
+    return true;
+}
+
+static bool ss_parseFilter(FilterRule *rule, uint8_t *buffer, size_t length) {
+    // Parses the filter part of an f command, which is
+    // a field letter followed by the value to match
+    memset(rule, 0, sizeof(*rule));
+    char field = buffer[0];
+    buffer++; length--;
+    while (length > 0 && (buffer[length-1] == 10 || buffer[length-1] == 13)) length--;
+    if (length == 0) return false;
+
+    if (field == 's' || field == 'd' || field == 'p') {
+        if (field == 's') rule->type = FILTER_SRC;
+        if (field == 'd') rule->type = FILTER_DST;
+        if (field == 'p') rule->type = FILTER_PATH;
+        if (!ss_parseCall(rule->value, buffer, length, FILTER_ANY_SSID)) return false;
+    } else if (field == 't') {
+        rule->type = FILTER_DTI;
+        rule->value[0] = buffer[0];
+    } else if (field == 'f') {
+        rule->type = FILTER_FRAME;
+        if (buffer[0] == 'i') {
+            rule->value[0] = FILTER_FRAME_I;
+        } else if (buffer[0] == 's') {
+            rule->value[0] = FILTER_FRAME_S;
+        } else if (buffer[0] == 'u' && length > 1 && buffer[1] == 'i') {
+            rule->value[0] = FILTER_FRAME_UI;
+        } else if (buffer[0] == 'u') {
+            rule->value[0] = FILTER_FRAME_U;
+        } else {
+            return false;
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
+
 void ss_serialCallback(void *_buffer, size_t length, AX25Ctx *ctx) {
     uint8_t *buffer = (uint8_t *)_buffer;
     if (length > 0) {
@@ -335,6 +534,22 @@ void ss_serialCallback(void *_buffer, size_t length, AX25Ctx *ctx) {
         #endif
         else if (buffer[0] == 'H') {
             ss_printSettings();
+        } else if (buffer[0] == 'i') {
+            if (length > 1 && buffer[1] == 'r') {
+                stats_reset();
+                if (VERBOSE) printf_P(PSTR("Statistics reset\n"));
+                if (!VERBOSE && !SILENT) printf_P(PSTR("1\n"));
+            } else if (length > 1 && buffer[1] == 'm') {
+                ss_printRam();
+            } else if (length > 1 && buffer[1] == 'h') {
+                ss_printHeard();
+            } else if (length > 1 && buffer[1] == 'd') {
+                ss_printDcd();
+            } else if (length > 1 && buffer[1] == 'l') {
+                ss_printLoad();
+            } else {
+                ss_printStats();
+            }
         } else if (buffer[0] == 'S') {
             ss_saveSettings();
         } else if (buffer[0] == 'C') {
@@ -520,6 +735,17 @@ void ss_serialCallback(void *_buffer, size_t length, AX25Ctx *ctx) {
                     if (!VERBOSE && !SILENT) printf_P(PSTR("1\n"));
                 }
             }
+            if (buffer[0] == 'r') {
+                if (buffer[1] == 49) {
+                    PRINT_RXINFO = true;
+                    if (VERBOSE) printf_P(PSTR("Print RX metadata enabled\n"));
+                    if (!VERBOSE && !SILENT) printf_P(PSTR("1\n"));
+                } else {
+                    PRINT_RXINFO = false;
+                    if (VERBOSE) printf_P(PSTR("Print RX metadata disabled\n"));
+                    if (!VERBOSE && !SILENT) printf_P(PSTR("1\n"));
+                }
+            }
         } else if (buffer[0] == 'v') {
             if (buffer[1] == 49) {
                 VERBOSE = true;
@@ -642,6 +868,102 @@ void ss_serialCallback(void *_buffer, size_t length, AX25Ctx *ctx) {
                 }
             }
 
+        } else if (buffer[0] == 'f') {
+            buffer++; length--;
+            if (length == 0) {
+                ss_printFilters();
+            } else if (buffer[0] == 'c') {
+                filter_clear();
+                if (VERBOSE) printf_P(PSTR("Filters cleared\n"));
+                if (!VERBOSE && !SILENT) printf_P(PSTR("1\n"));
+            } else if (buffer[0] == 'r' && length > 1 && buffer[1] >= 48 && buffer[1] <= 57) {
+                FilterRule rule = { .type = FILTER_NONE };
+                if (filter_set(buffer[1]-48, &rule)) {
+                    if (VERBOSE) printf_P(PSTR("Filter %d removed\n"), buffer[1]-48);
+                    if (!VERBOSE && !SILENT) printf_P(PSTR("1\n"));
+                } else {
+                    if (VERBOSE) printf_P(PSTR("Error: Invalid filter\n"));
+                    if (!VERBOSE && !SILENT) printf_P(PSTR("0\n"));
+                }
+            } else {
+                FilterRule rule;
+                if (ss_parseFilter(&rule, buffer, length) && filter_add(&rule)) {
+                    if (VERBOSE) printf_P(PSTR("Filter added\n"));
+                    if (!VERBOSE && !SILENT) printf_P(PSTR("1\n"));
+                } else {
+                    if (VERBOSE) printf_P(PSTR("Error: Invalid filter or filter table full\n"));
+                    if (!VERBOSE && !SILENT) printf_P(PSTR("0\n"));
+                }
+            }
+        } else if (buffer[0] == 'r' && length > 1) {
+            buffer++; length--;
+            if (buffer[0] == 'c' && length > 1) {
+                if (ss_parseCall(digi.call, buffer+1, length-1, 0)) {
+                    if (VERBOSE) printf_P(PSTR("Digipeater call: %.6s-%d\n"), digi.call, digi.call[6]);
+                    if (!VERBOSE && !SILENT) printf_P(PSTR("1\n"));
+                } else {
+                    if (VERBOSE) printf_P(PSTR("Error: Invalid callsign\n"));
+                    if (!VERBOSE && !SILENT) printf_P(PSTR("0\n"));
+                }
+            } else if (buffer[0] == 'a' && length > 1) {
+                uint8_t i = 0;
+                while (i < CONFIG_DIGI_ALIASES && digi.aliases[i][0] != 0) i++;
+                if (i < CONFIG_DIGI_ALIASES && ss_parseCall(digi.aliases[i], buffer+1, length-1, 0)) {
+                    if (VERBOSE) printf_P(PSTR("Digipeater alias added: %.6s-%d\n"), digi.aliases[i], digi.aliases[i][6]);
+                    if (!VERBOSE && !SILENT) printf_P(PSTR("1\n"));
+                } else {
+                    if (VERBOSE) printf_P(PSTR("Error: Invalid alias or alias list full\n"));
+                    if (!VERBOSE && !SILENT) printf_P(PSTR("0\n"));
+                }
+            } else if (buffer[0] == 'x') {
+                memset(digi.aliases, 0, sizeof(digi.aliases));
+                if (VERBOSE) printf_P(PSTR("Digipeater aliases cleared\n"));
+                if (!VERBOSE && !SILENT) printf_P(PSTR("1\n"));
+            } else if (buffer[0] == 'h' && length > 1 && buffer[1] >= 48 && buffer[1] <= 55) {
+                digi.max_hops = buffer[1] - 48;
+                if (VERBOSE) printf_P(PSTR("Digipeater max hops set to %d\n"), digi.max_hops);
+                if (!VERBOSE && !SILENT) printf_P(PSTR("1\n"));
+            } else if (buffer[0] == 49) {
+                digi.enabled = true;
+                if (VERBOSE) printf_P(PSTR("Digipeater enabled\n"));
+                if (!VERBOSE && !SILENT) printf_P(PSTR("1\n"));
+            } else {
+                digi.enabled = false;
+                if (VERBOSE) printf_P(PSTR("Digipeater disabled\n"));
+                if (!VERBOSE && !SILENT) printf_P(PSTR("1\n"));
+            }
+        } else if (buffer[0] == 'k') {
+            buffer++; length--;
+            if (length == 0) {
+                ss_printCalibration();
+            } else if (buffer[0] == 't' && length > 1) {
+                // The trim is a signed number of CPU
+                // cycles, like kt-3
+                bool negative = (buffer[1] == '-');
+                int trim = 0;
+                bool valid = false;
+                for (size_t i = negative ? 2 : 1; i < length && buffer[i] >= 48 && buffer[i] <= 57 && trim <= 128; i++) {
+                    trim = trim * 10 + buffer[i] - 48;
+                    valid = true;
+                }
+                if (negative) trim = -trim;
+                if (valid && trim >= INT8_MIN && trim <= INT8_MAX) {
+                    calibration_setTrim(trim);
+                    if (VERBOSE) printf_P(PSTR("Clock trim set to %d\n"), calibration.trim);
+                    if (!VERBOSE && !SILENT) printf_P(PSTR("1\n"));
+                } else {
+                    if (VERBOSE) printf_P(PSTR("Error: Invalid clock trim\n"));
+                    if (!VERBOSE && !SILENT) printf_P(PSTR("0\n"));
+                }
+            } else if (buffer[0] == 49) {
+                calibration_start();
+                if (VERBOSE) printf_P(PSTR("Clock calibration started\n"));
+                if (!VERBOSE && !SILENT) printf_P(PSTR("1\n"));
+            } else {
+                calibration_stop();
+                if (VERBOSE) printf_P(PSTR("Clock calibration stopped\n"));
+                if (!VERBOSE && !SILENT) printf_P(PSTR("1\n"));
+            }
         } else if (buffer[0] == 'w' && length >= 2) {
             char str[4]; buffer++;
             memcpy(str, buffer, length-1);
@@ -671,10 +993,7 @@ void ss_serialCallback(void *_buffer, size_t length, AX25Ctx *ctx) {
 
 }
 
-void ss_sendPkt(void *_buffer, size_t length, AX25Ctx *ax25) {
-
-    uint8_t *buffer = (uint8_t *)_buffer;
-
+static void ss_sendSpans(const AX25Span *spans, size_t count, AX25Ctx *ax25) {
     memcpy(dst.call, DST, 6);
     dst.ssid = DST_SSID;
 
@@ -692,98 +1011,92 @@ void ss_sendPkt(void *_buffer, size_t length, AX25Ctx *ax25) {
     path[2] = path1;
     path[3] = path2;
 
-    ax25_sendVia(ax25, path, countof(path), buffer, length);
+    ax25_sendSpans(ax25, path, countof(path), spans, count);
+}
+
+void ss_sendPkt(void *_buffer, size_t length, AX25Ctx *ax25) {
+    AX25Span span = { _buffer, length };
+    ss_sendSpans(&span, 1, ax25);
 }
 
 void ss_sendLoc(void *_buffer, size_t length, AX25Ctx *ax25) {
-    size_t payloadLength = 20+length;
-    bool usePHG = false;
+    // The position header is assembled on the stack,
+    // and the comment is sent straight from the buffer
+    uint8_t header[27];
+    size_t headerLength = 20;
+    header[0] = '=';
+    memcpy(header+1, latitude, 8);
+    header[9] = symbolTable;
+    memcpy(header+10, longtitude, 9);
+    header[19] = symbol;
     if (power < 10 && height < 10 && gain < 10 && directivity < 9) {
-        usePHG = true;
-        payloadLength += 7;
-    }
-    uint8_t *packet = malloc(payloadLength);
-    uint8_t *ptr = packet;
-    packet[0] = '=';
-    packet[9] = symbolTable;
-    packet[19] = symbol;
-    ptr++;
-    memcpy(ptr, latitude, 8);
-    ptr += 9;
-    memcpy(ptr, longtitude, 9);
-    ptr += 10;
-    if (usePHG) {
-        packet[20] = 'P';
-        packet[21] = 'H';
-        packet[22] = 'G';
-        packet[23] = power+48;
-        packet[24] = height+48;
-        packet[25] = gain+48;
-        packet[26] = directivity+48;
-        ptr+=7;
-    }
-    if (length > 0) {
-        uint8_t *buffer = (uint8_t *)_buffer;
-        memcpy(ptr, buffer, length);
+        header[20] = 'P';
+        header[21] = 'H';
+        header[22] = 'G';
+        header[23] = power+48;
+        header[24] = height+48;
+        header[25] = gain+48;
+        header[26] = directivity+48;
+        headerLength += 7;
     }
 
-    //printf_P(PSTR("Assembled packet:\n%.*s\n", payloadLength, packet);
-    ss_sendPkt(packet, payloadLength, ax25);
-    free(packet);
+    AX25Span spans[2] = {
+        { header, headerLength },
+        { _buffer, length },
+    };
+    ss_sendSpans(spans, 2, ax25);
 }
 
 void ss_sendMsg(void *_buffer, size_t length, AX25Ctx *ax25) {
     if (length > 67) length = 67;
-    size_t payloadLength = 11+length+4;
 
-    uint8_t *packet = malloc(payloadLength);
-    uint8_t *ptr = packet;
-    packet[0] = ':';
+    uint8_t header[11];
+    header[0] = ':';
     int callSize = 6;
     int count = 0;
     while (callSize--) {
         if (message_recip[count] != 0) {
-            packet[1+count] = message_recip[count];
+            header[1+count] = message_recip[count];
             count++;
         }
     }
     if (message_recip_ssid != -1) {
-        packet[1+count] = '-'; count++;
+        header[1+count] = '-'; count++;
         if (message_recip_ssid < 10) {
-            packet[1+count] = message_recip_ssid+48; count++;
+            header[1+count] = message_recip_ssid+48; count++;
         } else {
-            packet[1+count] = 49; count++;
-            packet[1+count] = message_recip_ssid-10+48; count++;
+            header[1+count] = 49; count++;
+            header[1+count] = message_recip_ssid-10+48; count++;
         }
     }
     while (count < 9) {
-        packet[1+count] = ' '; count++;
+        header[1+count] = ' '; count++;
     }
-    packet[1+count] = ':';
-    ptr += 11;
+    header[1+count] = ':';
     if (length > 0) {
-        uint8_t *buffer = (uint8_t *)_buffer;
-        memcpy(ptr, buffer, length);
-        memcpy(lastMessage, buffer, length);
+        memcpy(lastMessage, _buffer, length);
         lastMessageLen = length;
     }
 
     message_seq++;
     if (message_seq > 999) message_seq = 0;
 
-    packet[11+length] = '{';
+    uint8_t trailer[4];
+    trailer[0] = '{';
     int n = message_seq % 10;
     int d = ((message_seq % 100) - n)/10;
     int h = (message_seq - d - n) / 100;
 
-    packet[12+length] = h+48;
-    packet[13+length] = d+48;
-    packet[14+length] = n+48;
-
-    //printf_P(PSTR("Assembled packet:\n%.*s\n", payloadLength, packet);
-    ss_sendPkt(packet, payloadLength, ax25);
+    trailer[1] = h+48;
+    trailer[2] = d+48;
+    trailer[3] = n+48;
 
-    free(packet);
+    AX25Span spans[3] = {
+        { header, sizeof(header) },
+        { _buffer, length },
+        { trailer, sizeof(trailer) },
+    };
+    ss_sendSpans(spans, 3, ax25);
 }
 
 void ss_msgRetry(AX25Ctx *ax25) {
@@ -811,6 +1124,144 @@ void ss_printSettings(void) {
     printf_P(PSTR("Symbol: %c\n"), symbol);
     printf_P(PSTR("TX Preamble: %lu\n"), custom_preamble);
     printf_P(PSTR("TX Tail: %lu\n"), custom_tail);
+    if (digi.enabled) {
+        printf_P(PSTR("Digipeater: On, %.6s-%d, max hops %d\n"), digi.call, digi.call[6], digi.max_hops);
+    } else {
+        printf_P(PSTR("Digipeater: Off\n"));
+    }
+    for (uint8_t i = 0; i < CONFIG_DIGI_ALIASES; i++) {
+        if (digi.aliases[i][0] != 0) printf_P(PSTR("Digipeater alias: %.6s-%d\n"), digi.aliases[i], digi.aliases[i][6]);
+    }
+}
+
+void ss_printStats(void) {
+    Stats snapshot;
+    stats_snapshot(&snapshot);
+    unsigned long elapsed = timer_clock() - snapshot.epoch;
+
+    if (VERBOSE) {
+        printf_P(PSTR("Statistics:\n"));
+        printf_P(PSTR("Flags seen: %lu\n"), snapshot.flags);
+        printf_P(PSTR("Frames started: %lu\n"), snapshot.frames_started);
+        printf_P(PSTR("Frames received: %lu\n"), snapshot.rx_frames);
+        printf_P(PSTR("CRC errors: %lu\n"), snapshot.crc_errors);
+        printf_P(PSTR("RX overruns: %lu\n"), snapshot.rx_overruns);
+        printf_P(PSTR("Frames sent: %lu\n"), snapshot.tx_frames);
+        printf_P(PSTR("TX time: %lus\n"), snapshot.tx_ticks / CLOCK_TICKS_PER_SEC);
+        printf_P(PSTR("DCD time: %lus\n"), snapshot.dcd_ticks / CLOCK_TICKS_PER_SEC);
+        printf_P(PSTR("Max ISR time: %u cycles\n"), snapshot.isr_max);
+        printf_P(PSTR("Digipeats dropped: %lu\n"), snapshot.digi_dropped);
+        printf_P(PSTR("Elapsed: %lus\n"), elapsed / CLOCK_TICKS_PER_SEC);
+
+        // Share of the time the CPU was awake, in
+        // tenths of a percent
+        unsigned long perMille = elapsed / 1000;
+        if (perMille > 0) {
+            unsigned long idle = snapshot.idle_ticks / perMille;
+            unsigned long active = (idle < 1000) ? 1000 - idle : 0;
+            printf_P(PSTR("Active duty cycle: %lu.%lu%%\n"), active / 10, active % 10);
+        }
+    } else {
+        printf_P(PSTR("%lu %lu %lu %lu %lu %lu %lu %lu %u %lu %lu %lu\n"),
+            snapshot.flags, snapshot.frames_started,
+            snapshot.rx_frames, snapshot.crc_errors,
+            snapshot.rx_overruns, snapshot.tx_frames,
+            snapshot.tx_ticks, snapshot.dcd_ticks,
+            snapshot.isr_max, elapsed, snapshot.idle_ticks,
+            snapshot.digi_dropped);
+    }
+}
+
+void ss_printRam(void) {
+    if (VERBOSE) {
+        printf_P(PSTR("Free RAM: %u bytes\n"), ram_free());
+        printf_P(PSTR("Min free RAM: %u bytes\n"), ram_minFree());
+    } else {
+        printf_P(PSTR("%u %u\n"), ram_free(), ram_minFree());
+    }
+}
+
+void ss_printDcd(void) {
+    Afsk *modem = ax25ctx->modem;
+    if (VERBOSE) {
+        printf_P(PSTR("Carrier: %s\n"), modem->carrier ? "yes" : "no");
+        printf_P(PSTR("Quality: %d of 32\n"), modem->dcdQuality);
+        printf_P(PSTR("Level: %d\n"), modem->dcdLevel);
+        printf_P(PSTR("HDLC DCD: %s\n"), modem->hdlc.dcd ? "yes" : "no");
+    } else {
+        printf_P(PSTR("%d %d %d %d\n"), modem->carrier, modem->dcdQuality, modem->dcdLevel, modem->hdlc.dcd);
+    }
+}
+
+void ss_printLoad(void) {
+    uint8_t load = load_get();
+    if (VERBOSE) {
+        uint16_t permille = DIV_ROUND(load * 1000UL, 255);
+        printf_P(PSTR("Channel load: %u.%u%% over %ds\n"), permille / 10, permille % 10, CONFIG_LOAD_SECONDS);
+    } else {
+        printf_P(PSTR("%d\n"), load);
+    }
+}
+
+void ss_printHeard(void) {
+    ticks_t now = timer_clock();
+    const HeardEntry *entry;
+    if (VERBOSE && heard_count() == 0) printf_P(PSTR("No stations heard\n"));
+    for (uint8_t n = 0; (entry = heard_get(n)) != NULL; n++) {
+        unsigned long age = (now - entry->last) / CLOCK_TICKS_PER_SEC;
+        if (VERBOSE) {
+            printf_P(PSTR("%.6s-%d: %lus ago, %u packets, "), entry->call, entry->call[6], age, entry->count);
+            if (entry->direct) {
+                printf_P(PSTR("direct"));
+            } else {
+                printf_P(PSTR("via digi"));
+            }
+            printf_P(PSTR(", level %d\n"), entry->level);
+        } else {
+            printf_P(PSTR("%.6s-%d %lu %u %d %d\n"), entry->call, entry->call[6], age, entry->count, entry->direct, entry->level);
+        }
+    }
+}
+
+void ss_printCalibration(void) {
+    if (VERBOSE) {
+        if (calibration.active) {
+            printf_P(PSTR("Clock calibration running, %d of %d frames\n"), calibration.frames, CONFIG_CALIBRATION_FRAMES);
+        } else {
+            printf_P(PSTR("Clock calibration not running\n"));
+        }
+        printf_P(PSTR("Clock trim: %d\n"), calibration.trim);
+    } else {
+        printf_P(PSTR("%d %d %d\n"), calibration.active, calibration.frames, calibration.trim);
+    }
+}
+
+void ss_printFilters(void) {
+    FilterRule rule;
+    bool empty = true;
+    for (uint8_t i = 0; filter_get(i, &rule); i++) {
+        if (rule.type == FILTER_NONE) continue;
+        empty = false;
+        printf_P(PSTR("Filter %d: "), i);
+        if (rule.type == FILTER_SRC) printf_P(PSTR("SRC "));
+        if (rule.type == FILTER_DST) printf_P(PSTR("DST "));
+        if (rule.type == FILTER_PATH) printf_P(PSTR("PATH "));
+        if (rule.type == FILTER_SRC || rule.type == FILTER_DST || rule.type == FILTER_PATH) {
+            printf_P(PSTR("%.6s"), rule.value);
+            if (rule.value[6] != FILTER_ANY_SSID) printf_P(PSTR("-%d"), rule.value[6]);
+            printf_P(PSTR("\n"));
+        } else if (rule.type == FILTER_DTI) {
+            printf_P(PSTR("Type %c\n"), rule.value[0]);
+        } else if (rule.type == FILTER_FRAME) {
+            if (rule.value[0] == FILTER_FRAME_I) printf_P(PSTR("Frame I\n"));
+            if (rule.value[0] == FILTER_FRAME_S) printf_P(PSTR("Frame S\n"));
+            if (rule.value[0] == FILTER_FRAME_U) printf_P(PSTR("Frame U\n"));
+            if (rule.value[0] == FILTER_FRAME_UI) printf_P(PSTR("Frame UI\n"));
+        } else {
+            printf_P(PSTR("Unknown\n"));
+        }
+    }
+    if (empty && VERBOSE) printf_P(PSTR("No filters set, all frames are shown\n"));
 }
 
 #if ENABLE_HELP
@@ -849,10 +1300,30 @@ void ss_printSettings(void) {
             printf_P(PSTR("pd<1/0>   Print DST on/off\n"));
             printf_P(PSTR("pp<1/0>   Print PATH on/off\n"));
             printf_P(PSTR("pm<1/0>   Print DATA on/off\n"));
-            printf_P(PSTR("pi<1/0>   Print INFO on/off\n\n"));
+            printf_P(PSTR("pi<1/0>   Print INFO on/off\n"));
+            printf_P(PSTR("pr<1/0>   Print RX metadata on/off\n\n"));
             printf_P(PSTR("v<1/0>    Verbose mode on/off\n"));
             printf_P(PSTR("V<1/0>    Silent mode on/off\n\n"));
 
+            printf_P(PSTR("r<1/0>    Digipeater on/off\n"));
+            printf_P(PSTR("rc<call>  Set digipeater callsign (eg N0CALL-10)\n"));
+            printf_P(PSTR("ra<call>  Add digipeater alias\n"));
+            printf_P(PSTR("rx        Clear digipeater aliases\n"));
+            printf_P(PSTR("rh<0-7>   Set largest n of WIDEn-N to repeat\n\n"));
+
+            printf_P(PSTR("fs<call>  Show frames from call (eg N0CALL or N0CALL-7)\n"));
+            printf_P(PSTR("fd<call>  Show frames to call\n"));
+            printf_P(PSTR("fp<call>  Show frames digipeated by call\n"));
+            printf_P(PSTR("ft<c>     Show frames with APRS data type c\n"));
+            printf_P(PSTR("ff<type>  Show frames of type i/s/u/ui\n"));
+            printf_P(PSTR("fr<0-9>   Remove filter\n"));
+            printf_P(PSTR("fc        Clear filters\n"));
+            printf_P(PSTR("f         Print filters\n\n"));
+
+            printf_P(PSTR("k<1/0>    Clock calibration on/off\n"));
+            printf_P(PSTR("kt<trim>  Set clock trim (-128 to 127)\n"));
+            printf_P(PSTR("k         Print clock calibration\n\n"));
+
             printf_P(PSTR("w<XXX>    Set preamble time in ms\n"));
             printf_P(PSTR("W<XXX>    Set transmission tail time in ms\n"));
 
@@ -860,6 +1331,12 @@ void ss_printSettings(void) {
             printf_P(PSTR("L         Load configuration\n"));
             printf_P(PSTR("C         Clear configuration\n"));
             printf_P(PSTR("H         Print configuration\n"));
+            printf_P(PSTR("i         Print statistics\n"));
+            printf_P(PSTR("ir        Reset statistics\n"));
+            printf_P(PSTR("im        Print free RAM\n"));
+            printf_P(PSTR("ih        Print heard stations\n"));
+            printf_P(PSTR("id        Print carrier detect state\n"));
+            printf_P(PSTR("il        Print channel load\n"));
             printf_P(PSTR("----------------------------------\n"));
     }
 #endif
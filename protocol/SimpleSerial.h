@@ -25,6 +25,13 @@ void ss_clearSettings(void);
 void ss_loadSettings(void);
 void ss_saveSettings(void);
 void ss_printSettings(void);
+void ss_printStats(void);
+void ss_printRam(void);
+void ss_printFilters(void);
+void ss_printHeard(void);
+void ss_printDcd(void);
+void ss_printLoad(void);
+void ss_printCalibration(void);
 
 void ss_printHelp(void);
 
@@ -0,0 +1,113 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+// Host check of the waveform segment table that the
+// modulator uses with CONFIG_AFSK_DAC_SEGMENTS. The
+// table is rendered from hardware/AFSK_tables.h, the
+// same way the firmware builds it, and checked in two
+// ways. Every segment must hold the samples that the
+// per-sample phase accumulator outputs for its tone
+// and starting phase. Then a long random bit stream is
+// modulated both ways, and the outputs must match
+// sample for sample. The accumulator never jumps, so a
+// match shows the phase is continuous across every bit
+// boundary. As a coarser check on the signal itself,
+// the output must not step further at a boundary than
+// it does inside a bit, since such a step would show
+// up as a click in the spectrum.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// The bits of avr-libc that the tables use
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define _BV(bit) (1 << (bit))
+
+// The 1200 baud profile from AFSK.h, which is the only
+// one segments are implemented for
+#define CONFIG_AFSK_DAC_SAMPLERATE 9600
+#define CONFIG_AFSK_DAC_TABLE true
+#define CONFIG_AFSK_DAC_SEGMENTS true
+#define MARK_FREQ 1200
+#define SPACE_FREQ 2200
+#define SAMPLESPERBIT 8
+
+#include "../hardware/AFSK_tables.h"
+
+#define BITS 200000L
+
+static uint32_t rng = 0x12345678;
+
+static bool randomBit(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng & 1;
+}
+
+// Distance between two output samples, in DAC steps
+static int step(uint8_t a, uint8_t b) {
+    return abs((a >> 4) - (b >> 4));
+}
+
+int main(void) {
+    const uint16_t inc[2] = { MARK_INC, SPACE_INC };
+    long mismatches = 0;
+
+    // Every segment against the phase accumulator
+    for (uint8_t tone = 0; tone < 2; tone++) {
+        for (uint16_t start = 0; start < SIN_LEN; start += SEG_QUANTUM) {
+            const uint8_t *segment = &seg_table[SEG_OFFSET(tone, start)];
+            uint16_t phase = start;
+            for (uint8_t k = 0; k < SAMPLESPERBIT; k++) {
+                phase = (phase + inc[tone]) % SIN_LEN;
+                if (pgm_read_byte(&segment[k]) != dacSample(phase)) mismatches++;
+            }
+        }
+    }
+    printf("AFSK_tables.h: %d segment samples, %ld mismatches\n", SEG_SIZE, mismatches);
+
+    // A random bit stream, NRZI coded like the
+    // modulator does, so a zero switches the tone
+    long streamMismatches = 0;
+    int maxInside = 0;
+    int maxBoundary = 0;
+    uint16_t segPhase = 0;
+    uint16_t accPhase = 0;
+    uint8_t tone = 0;
+    uint8_t last = dacSample(0);
+    for (long bit = 0; bit < BITS; bit++) {
+        if (!randomBit()) tone ^= 1;
+
+        const uint8_t *segment = &seg_table[SEG_OFFSET(tone, segPhase)];
+        segPhase = (segPhase + SAMPLESPERBIT * inc[tone]) % SIN_LEN;
+
+        for (uint8_t k = 0; k < SAMPLESPERBIT; k++) {
+            accPhase = (accPhase + inc[tone]) % SIN_LEN;
+            uint8_t sample = pgm_read_byte(&segment[k]);
+            if (sample != dacSample(accPhase)) streamMismatches++;
+
+            int d = step(last, sample);
+            if (k == 0) {
+                if (d > maxBoundary) maxBoundary = d;
+            } else {
+                if (d > maxInside) maxInside = d;
+            }
+            last = sample;
+        }
+    }
+    printf("Bit stream: %ld bits, %ld mismatches\n", BITS, streamMismatches);
+    printf("Largest step: %d inside a bit, %d at a bit boundary\n", maxInside, maxBoundary);
+
+    if (mismatches || streamMismatches || maxBoundary > maxInside) {
+        printf("FAILED\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,151 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+// Host check of the carrier detector. The modem code in
+// hardware/AFSK.c is built for the host, with the
+// avr-libc headers from host/, and samples are fed
+// straight into AFSK_adc_isr. Two kinds of input are
+// used. The first is noise at a range of levels, 10
+// seconds each, which must never be taken for a
+// carrier. The second is packet data from the modem's
+// own modulator, looped back through AFSK_dac_isr with
+// and without added noise, where the carrier must be
+// detected during the preamble and held until the
+// transmission ends. After every sample, a change of
+// the carrier state must agree with the on and off
+// thresholds in device.h.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "hardware/AFSK.h"
+
+void AFSK_adc_isr(Afsk *afsk, int8_t currentSample);
+uint8_t AFSK_dac_isr(Afsk *afsk);
+
+#define HOST_DEFINE8(name) volatile uint8_t name;
+#define HOST_DEFINE16(name) volatile uint16_t name;
+HOST_REGISTERS(HOST_DEFINE8, HOST_DEFINE16)
+
+unsigned long custom_preamble = 300;
+unsigned long custom_tail = 50;
+
+#define NOISE_SECONDS 10
+#define MS(samples) ((samples) * 1000L / SAMPLERATE)
+
+// Carrier detection has to be done within this much
+// of the preamble
+#define MAX_DETECT_MS 40
+
+static Afsk modem;
+static long failures;
+
+static uint32_t rng = 0x2545F491;
+
+static uint32_t random32(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+// Roughly gaussian noise, from the sum of four
+// uniform values, with the given peak level
+static int noise(int peak) {
+    int sum = 0;
+    for (int i = 0; i < 4; i++) sum += (int)(random32() % 513) - 256;
+    return sum * peak / 1024;
+}
+
+static int8_t clip(int sample) {
+    if (sample > 127) return 127;
+    if (sample < -128) return -128;
+    return sample;
+}
+
+// Runs one sample through the demodulator, and checks
+// that the carrier only changed state as the
+// thresholds allow
+static void sample(int8_t s) {
+    bool before = modem.carrier;
+    AFSK_adc_isr(&modem, s);
+    while (afsk_read(&modem) != EOF) { /* Drop decoded data */ }
+
+    uint8_t quality = modem.dcdQuality;
+    uint8_t level = modem.dcdLevel;
+    if (!before && modem.carrier) {
+        if (quality < CONFIG_DCD_QUALITY_ON || level < CONFIG_DCD_MIN_LEVEL) {
+            printf("Carrier on at quality %u, level %u\n", quality, level);
+            failures++;
+        }
+    } else if (before && !modem.carrier) {
+        if (quality >= CONFIG_DCD_QUALITY_OFF && level >= CONFIG_DCD_MIN_LEVEL) {
+            printf("Carrier off at quality %u, level %u\n", quality, level);
+            failures++;
+        }
+    }
+}
+
+static void checkNoise(int peak) {
+    AFSK_init(&modem);
+    long on = 0;
+    uint8_t maxQuality = 0;
+    for (long i = 0; i < NOISE_SECONDS * (long)SAMPLERATE; i++) {
+        sample(clip(noise(peak)));
+        if (modem.carrier) on++;
+        if (modem.dcdQuality > maxQuality) maxQuality = modem.dcdQuality;
+    }
+    printf("Noise, peak %3d: highest quality %2u, carrier for %ld ms\n", peak, maxQuality, MS(on));
+    if (on > 0) failures++;
+}
+
+// Sends a frame's worth of bytes through the modulator,
+// with the given gain (0-128) and peak noise level
+static void checkSignal(int gain, int peak) {
+    AFSK_init(&modem);
+    for (long i = 0; i < SAMPLERATE / 2; i++) sample(clip(noise(peak)));
+
+    for (int i = 0; i < 40; i++) afsk_write(&modem, 0x40 + i);
+    long start = -1;
+    long dropped = 0;
+    long n = 0;
+    while (modem.sending) {
+        int s = ((int)AFSK_dac_isr(&modem) - 128) * gain / 128;
+        sample(clip(s + noise(peak)));
+        if (modem.carrier && start < 0) start = n;
+        if (!modem.carrier && start >= 0) dropped++;
+        n++;
+    }
+
+    // Once the signal is gone, the carrier must be
+    // dropped within a few bit periods
+    long off = -1;
+    for (long i = 0; i < SAMPLERATE / 2; i++) {
+        sample(clip(noise(peak)));
+        if (!modem.carrier && off < 0) off = i;
+    }
+
+    printf("Signal, gain %3d, noise %2d: carrier after %ld ms, lost for %ld ms, off %ld ms after the end\n",
+           gain, peak, start < 0 ? -1 : MS(start), MS(dropped), off < 0 ? -1 : MS(off));
+    if (start < 0 || MS(start) > MAX_DETECT_MS || dropped > 0 || off < 0 || MS(off) > MAX_DETECT_MS) failures++;
+}
+
+int main(void) {
+    const int levels[] = { 4, 16, 48, 96, 127 };
+    for (unsigned i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) checkNoise(levels[i]);
+
+    checkSignal(128, 0);
+    checkSignal(32, 0);
+    checkSignal(96, 16);
+    checkSignal(64, 24);
+
+    if (failures) {
+        printf("FAILED\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,188 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+// Host decode benchmark. There is no recording of a
+// radio channel in this tree, so the samples come from
+// the modem's own modulator. A fixed set of random
+// frames is sent through AFSK_dac_isr, noise is added
+// at a range of levels, and the samples are fed to
+// AFSK_adc_isr. A frame counts as decoded when the
+// demodulator passes it on with a correct CRC and the
+// same contents as were sent. The noise comes from a
+// fixed seed, so the counts only change when the
+// demodulator does, and can be compared between builds
+// and options. Without noise, every frame must be
+// decoded.
+//
+// The receive FIFO is emptied after every sample, like
+// the main loop does. With CONFIG_IDLE_SLEEP it only
+// sleeps when the FIFO is empty, so this is the same
+// with and without the option.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "hardware/AFSK.h"
+#include "protocol/HDLC.h"
+#include "util/CRC-CCIT.h"
+
+void AFSK_adc_isr(Afsk *afsk, int8_t currentSample);
+uint8_t AFSK_dac_isr(Afsk *afsk);
+
+#define HOST_DEFINE8(name) volatile uint8_t name;
+#define HOST_DEFINE16(name) volatile uint16_t name;
+HOST_REGISTERS(HOST_DEFINE8, HOST_DEFINE16)
+
+unsigned long custom_preamble = 100;
+unsigned long custom_tail = 20;
+
+#define FRAMES 200
+#define MIN_LEN 18
+#define MAX_LEN 60
+
+static Afsk modem;
+
+static uint32_t rng;
+
+static uint32_t random32(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+// Roughly gaussian noise, from the sum of four
+// uniform values, with the given peak level
+static int noise(int peak) {
+    int sum = 0;
+    for (int i = 0; i < 4; i++) sum += (int)(random32() % 513) - 256;
+    return sum * peak / 1024;
+}
+
+static int8_t clip(int sample) {
+    if (sample > 127) return 127;
+    if (sample < -128) return -128;
+    return sample;
+}
+
+// The frame being sent, and the bytes the modulator
+// still needs for it, with flags, escapes and CRC
+static uint8_t frame[MAX_LEN];
+static size_t frameLen;
+static uint8_t txBytes[2 * MAX_LEN + 8];
+static size_t txLen;
+static size_t txPos;
+
+static void txPut(uint8_t c, uint16_t *crc) {
+    if (c == HDLC_FLAG || c == HDLC_RESET || c == AX25_ESC) txBytes[txLen++] = AX25_ESC;
+    *crc = update_crc_ccit(c, *crc);
+    txBytes[txLen++] = c;
+}
+
+static void makeFrame(void) {
+    frameLen = MIN_LEN + random32() % (MAX_LEN - MIN_LEN + 1);
+    for (size_t i = 0; i < frameLen; i++) frame[i] = random32();
+
+    uint16_t crc = CRC_CCIT_INIT_VAL;
+    txLen = 0;
+    txPos = 0;
+    txBytes[txLen++] = HDLC_FLAG;
+    for (size_t i = 0; i < frameLen; i++) txPut(frame[i], &crc);
+    uint8_t crcl = (crc & 0xff) ^ 0xff;
+    uint8_t crch = (crc >> 8) ^ 0xff;
+    txPut(crcl, &crc);
+    txPut(crch, &crc);
+    txBytes[txLen++] = HDLC_FLAG;
+}
+
+// Received bytes since the last flag, unescaped. The
+// CRC bytes are left at the end.
+static uint8_t rxBuf[MAX_LEN + 2];
+static size_t rxLen;
+static bool rxEscape;
+static bool rxSeq;
+static bool rxGood;
+static long decoded;
+
+static void receive(int c) {
+    if (rxSeq) {
+        // The sequence number after HDLC_SEQ is only
+        // needed by the protocol layer
+        if (c == AX25_ESC && !rxEscape) {
+            rxEscape = true;
+        } else {
+            rxEscape = false;
+            rxSeq = false;
+            rxGood = true;
+        }
+        return;
+    }
+
+    if (!rxEscape && c == HDLC_SEQ) {
+        rxSeq = true;
+    } else if (!rxEscape && c == HDLC_FLAG) {
+        if (rxGood && rxLen == frameLen + 2 && memcmp(rxBuf, frame, frameLen) == 0) decoded++;
+        rxLen = 0;
+        rxGood = false;
+    } else if (!rxEscape && c == HDLC_RESET) {
+        rxLen = 0;
+        rxGood = false;
+    } else if (!rxEscape && c == AX25_ESC) {
+        rxEscape = true;
+    } else {
+        rxEscape = false;
+        if (rxLen < sizeof(rxBuf)) rxBuf[rxLen++] = c;
+    }
+}
+
+static void sample(int8_t s) {
+    AFSK_adc_isr(&modem, s);
+    int c;
+    while ((c = afsk_read(&modem)) != EOF) receive(c);
+}
+
+// Sends the frames one at a time, with the given gain
+// (0-128) and peak noise level, and returns how many of
+// them were decoded
+static long run(int gain, int peak) {
+    AFSK_init(&modem);
+    rng = 0x2545F491;
+    decoded = 0;
+    rxLen = 0;
+    rxEscape = rxSeq = rxGood = false;
+
+    for (int n = 0; n < FRAMES; n++) {
+        makeFrame();
+        while (txPos < txLen || modem.sending) {
+            if (txPos < txLen && !fifo_isfull(&modem.txFifo)) afsk_write(&modem, txBytes[txPos++]);
+            int s = ((int)AFSK_dac_isr(&modem) - 128) * gain / 128;
+            sample(clip(s + noise(peak)));
+        }
+        for (int i = 0; i < SAMPLERATE / 20; i++) sample(clip(noise(peak)));
+    }
+    return decoded;
+}
+
+int main(void) {
+    const int levels[] = { 0, 16, 32, 48, 64, 80 };
+    long total = 0;
+    long clean = 0;
+    for (unsigned i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        long n = run(64, levels[i]);
+        printf("Gain 64, noise %2d: %3ld of %d frames decoded\n", levels[i], n, FRAMES);
+        if (levels[i] == 0) clean = n;
+        total += n;
+    }
+    printf("Total: %ld of %ld frames decoded\n", total, (long)FRAMES * (long)(sizeof(levels) / sizeof(levels[0])));
+
+    if (clean != FRAMES) {
+        printf("FAILED\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,360 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+// Host check of hardware/AFSK_demod.S against the C
+// demodulator filter in AFSK_adc_isr. The assembly
+// source is read and run on a small model of the AVR
+// core that only knows the instructions the routine
+// uses, so it runs on any machine with a C compiler.
+// Every pair of input samples is run from a number of
+// filter states, and the resulting iirX, iirY and
+// sampledBits must match the C version exactly. The
+// model also counts CPU cycles, using the ATmega328P
+// instruction timings.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+
+#define MAX_INSNS 128
+#define MAX_LABELS 16
+#define STATE_ADDR 0x0100
+#define CALL_CYCLES 4           // The call into the routine
+
+typedef struct Insn {
+    char op[8];
+    char arg[2][16];
+    int line;
+} Insn;
+
+typedef struct Label {
+    char name[32];
+    int pos;                    // Index of the next instruction
+} Label;
+
+static Insn insns[MAX_INSNS];
+static int insnCount;
+static Label labels[MAX_LABELS];
+static int labelCount;
+
+static uint8_t r[32];
+static uint8_t ram[0x0200];
+static bool fC, fZ, fN, fV, fS;
+
+static void fail(const Insn *insn, const char *msg) {
+    fprintf(stderr, "AFSK_demod.S:%d: %s\n", insn ? insn->line : 0, msg);
+    exit(2);
+}
+
+static char *trim(char *s) {
+    while (isspace((unsigned char)*s)) s++;
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) *--end = 0;
+    return s;
+}
+
+// Reads the routine, skipping comments, preprocessor
+// lines and assembler directives
+static void load(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) { perror(path); exit(2); }
+
+    char buf[256];
+    int line = 0;
+    while (fgets(buf, sizeof(buf), f)) {
+        line++;
+        char *c = strchr(buf, ';');
+        if (c) *c = 0;
+        char *s = trim(buf);
+        if (*s == 0 || *s == '#' || *s == '.') continue;
+
+        char *colon = strchr(s, ':');
+        if (colon) {
+            *colon = 0;
+            if (labelCount == MAX_LABELS) fail(NULL, "Too many labels");
+            snprintf(labels[labelCount].name, sizeof(labels[0].name), "%s", trim(s));
+            labels[labelCount++].pos = insnCount;
+            s = trim(colon + 1);
+            if (*s == 0) continue;
+        }
+
+        if (insnCount == MAX_INSNS) fail(NULL, "Too many instructions");
+        Insn *insn = &insns[insnCount++];
+        memset(insn, 0, sizeof(*insn));
+        insn->line = line;
+        sscanf(s, "%7s", insn->op);
+        char *args = s + strlen(insn->op);
+        for (int i = 0; i < 2 && *args; i++) {
+            char *comma = strchr(args, ',');
+            if (comma) *comma = 0;
+            snprintf(insn->arg[i], sizeof(insn->arg[i]), "%s", trim(args));
+            args = comma ? comma + 1 : args + strlen(args);
+        }
+    }
+    fclose(f);
+}
+
+static int reg(const Insn *insn, int n) {
+    const char *a = insn->arg[n];
+    if (tolower((unsigned char)a[0]) != 'r') fail(insn, "Expected a register");
+    int i = atoi(a + 1);
+    if (i < 0 || i > 31) fail(insn, "Bad register");
+    return i;
+}
+
+static int zOffset(const Insn *insn, int n) {
+    const char *a = insn->arg[n];
+    if (a[0] != 'Z' || a[1] != '+') fail(insn, "Expected Z+q");
+    return atoi(a + 2);
+}
+
+static int target(const Insn *insn, int pc) {
+    // Local labels: 1f is the next "1:" after this
+    // instruction and 1b is the last one before it
+    const char *a = insn->arg[0];
+    size_t len = strlen(a);
+    char name[16];
+    snprintf(name, sizeof(name), "%.*s", (int)len - 1, a);
+    if (a[len - 1] == 'f') {
+        for (int i = 0; i < labelCount; i++) {
+            if (strcmp(labels[i].name, name) == 0 && labels[i].pos > pc) return labels[i].pos;
+        }
+    } else if (a[len - 1] == 'b') {
+        for (int i = labelCount - 1; i >= 0; i--) {
+            if (strcmp(labels[i].name, name) == 0 && labels[i].pos <= pc) return labels[i].pos;
+        }
+    }
+    for (int i = 0; i < labelCount; i++) {
+        if (strcmp(labels[i].name, a) == 0) return labels[i].pos;
+    }
+    fail(insn, "Unknown label");
+    return 0;
+}
+
+static void flagsNZ(uint8_t res) {
+    fN = res & 0x80;
+    fZ = res == 0;
+    fS = fN ^ fV;
+}
+
+static uint8_t sub(uint8_t d, uint8_t s, bool carry, bool keepZ) {
+    uint8_t res = d - s - carry;
+    fC = (d < (unsigned)s + carry);
+    fV = ((d ^ s) & (d ^ res) & 0x80) != 0;
+    bool z = res == 0;
+    flagsNZ(res);
+    fZ = keepZ ? (z && fZ) : z;
+    return res;
+}
+
+static uint8_t add(uint8_t d, uint8_t s, bool carry) {
+    unsigned sum = d + s + carry;
+    uint8_t res = sum;
+    fC = sum > 0xFF;
+    fV = (~(d ^ s) & (d ^ res) & 0x80) != 0;
+    flagsNZ(res);
+    return res;
+}
+
+// Runs the routine from its entry point until it
+// returns, and gives the number of cycles it took
+static unsigned run(int entry) {
+    unsigned cycles = CALL_CYCLES;
+    int pc = entry;
+    for (;;) {
+        if (pc >= insnCount) fail(NULL, "Ran off the end of the routine");
+        const Insn *insn = &insns[pc++];
+        const char *op = insn->op;
+
+        if (!strcmp(op, "ret")) {
+            return cycles + 4;
+        } else if (!strcmp(op, "movw")) {
+            int d = reg(insn, 0), s = reg(insn, 1);
+            r[d] = r[s]; r[d + 1] = r[s + 1];
+            cycles += 1;
+        } else if (!strcmp(op, "mov")) {
+            r[reg(insn, 0)] = r[reg(insn, 1)];
+            cycles += 1;
+        } else if (!strcmp(op, "muls")) {
+            int16_t p = (int8_t)r[reg(insn, 0)] * (int8_t)r[reg(insn, 1)];
+            r[0] = (uint16_t)p; r[1] = (uint16_t)p >> 8;
+            fC = (uint16_t)p & 0x8000;
+            fZ = p == 0;
+            cycles += 2;
+        } else if (!strcmp(op, "clr") || (!strcmp(op, "eor") && reg(insn, 0) == reg(insn, 1))) {
+            r[reg(insn, 0)] = 0;
+            fV = false;
+            flagsNZ(0);
+            cycles += 1;
+        } else if (!strcmp(op, "asr")) {
+            int d = reg(insn, 0);
+            fC = r[d] & 0x01;
+            r[d] = (r[d] >> 1) | (r[d] & 0x80);
+            fN = r[d] & 0x80; fV = fN ^ fC;
+            flagsNZ(r[d]);
+            cycles += 1;
+        } else if (!strcmp(op, "ror")) {
+            int d = reg(insn, 0);
+            bool c = r[d] & 0x01;
+            r[d] = (r[d] >> 1) | (fC ? 0x80 : 0);
+            fC = c;
+            fN = r[d] & 0x80; fV = fN ^ fC;
+            flagsNZ(r[d]);
+            cycles += 1;
+        } else if (!strcmp(op, "lsl")) {
+            int d = reg(insn, 0);
+            r[d] = add(r[d], r[d], false);
+            cycles += 1;
+        } else if (!strcmp(op, "add") || !strcmp(op, "adc")) {
+            int d = reg(insn, 0);
+            r[d] = add(r[d], r[reg(insn, 1)], op[1] == 'd' && op[2] == 'c' && fC);
+            cycles += 1;
+        } else if (!strcmp(op, "cp")) {
+            sub(r[reg(insn, 0)], r[reg(insn, 1)], false, false);
+            cycles += 1;
+        } else if (!strcmp(op, "cpc")) {
+            sub(r[reg(insn, 0)], r[reg(insn, 1)], fC, true);
+            cycles += 1;
+        } else if (!strcmp(op, "ori")) {
+            int d = reg(insn, 0);
+            r[d] |= (uint8_t)strtol(insn->arg[1], NULL, 0);
+            fV = false;
+            flagsNZ(r[d]);
+            cycles += 1;
+        } else if (!strcmp(op, "ldd")) {
+            uint16_t z = r[30] | (r[31] << 8);
+            r[reg(insn, 0)] = ram[z + zOffset(insn, 1)];
+            cycles += 2;
+        } else if (!strcmp(op, "std")) {
+            uint16_t z = r[30] | (r[31] << 8);
+            ram[z + zOffset(insn, 0)] = r[reg(insn, 1)];
+            cycles += 2;
+        } else if (!strcmp(op, "brlt") || !strcmp(op, "brge") ||
+                   !strcmp(op, "breq") || !strcmp(op, "brne")) {
+            bool taken = !strcmp(op, "brlt") ? fS :
+                         !strcmp(op, "brge") ? !fS :
+                         !strcmp(op, "breq") ? fZ : !fZ;
+            if (taken) {
+                pc = target(insn, pc - 1);
+                cycles += 2;
+            } else {
+                cycles += 1;
+            }
+        } else {
+            fail(insn, "Instruction not supported by the model");
+        }
+    }
+}
+
+// The C version, as in AFSK_adc_isr with the 600Hz
+// filter
+typedef struct State {
+    int16_t iirX[2];
+    int16_t iirY[2];
+    uint8_t sampledBits;
+} State;
+
+static void demod_c(State *s, int8_t delayed, int8_t sample) {
+    s->iirX[0] = s->iirX[1];
+    s->iirX[1] = (delayed * sample) >> 2;
+    s->iirY[0] = s->iirY[1];
+    s->iirY[1] = s->iirX[0] + s->iirX[1] + (s->iirY[0] >> 1);
+    s->sampledBits <<= 1;
+    s->sampledBits |= (s->iirY[1] > 0) ? 0 : 1;
+}
+
+static void putWord(uint16_t addr, int16_t v) {
+    ram[addr] = (uint16_t)v;
+    ram[addr + 1] = (uint16_t)v >> 8;
+}
+
+static int16_t getWord(uint16_t addr) {
+    return (int16_t)(ram[addr] | (ram[addr + 1] << 8));
+}
+
+int main(int argc, char **argv) {
+    load(argc > 1 ? argv[1] : "hardware/AFSK_demod.S");
+
+    int entry = -1;
+    for (int i = 0; i < labelCount; i++) {
+        if (strcmp(labels[i].name, "afsk_demod_asm") == 0) entry = labels[i].pos;
+    }
+    if (entry < 0) fail(NULL, "afsk_demod_asm not found");
+
+    // Fixed states around zero, where the slicer
+    // decides, followed by random ones
+    const int16_t fixed[][2] = {
+        { 0, 0 }, { 0, 1 }, { 0, -1 }, { 1, 0 }, { -1, 0 }, { 1, -2 }, { -1, 2 },
+        { 4096, 16383 }, { -4064, -16384 }, { 32767, 32767 }, { -32768, -32768 },
+    };
+    const int states = 24;
+    unsigned long checked = 0, mismatches = 0;
+    unsigned minCycles = ~0U, maxCycles = 0;
+    unsigned long long sumCycles = 0;
+
+    srand(1200);
+    for (int n = 0; n < states; n++) {
+        State init;
+        if (n < (int)(sizeof(fixed) / sizeof(fixed[0]))) {
+            init.iirX[1] = fixed[n][0];
+            init.iirY[1] = fixed[n][1];
+        } else {
+            init.iirX[1] = (int16_t)(rand() % 8161 - 4064);
+            init.iirY[1] = (int16_t)rand();
+        }
+        init.iirX[0] = (int16_t)rand();
+        init.iirY[0] = (int16_t)rand();
+        init.sampledBits = rand();
+
+        for (int d = -128; d < 128; d++) {
+            for (int x = -128; x < 128; x++) {
+                State c = init;
+                demod_c(&c, d, x);
+
+                memset(r, 0xA5, sizeof(r));
+                r[1] = 0;
+                putWord(STATE_ADDR + 0, init.iirX[0]);
+                putWord(STATE_ADDR + 2, init.iirX[1]);
+                putWord(STATE_ADDR + 4, init.iirY[0]);
+                putWord(STATE_ADDR + 6, init.iirY[1]);
+                ram[STATE_ADDR + 8] = init.sampledBits;
+                r[24] = STATE_ADDR & 0xFF; r[25] = STATE_ADDR >> 8;
+                r[22] = (uint8_t)d;
+                r[20] = (uint8_t)x;
+
+                unsigned cycles = run(entry);
+                if (cycles < minCycles) minCycles = cycles;
+                if (cycles > maxCycles) maxCycles = cycles;
+                sumCycles += cycles;
+                checked++;
+
+                bool ok = getWord(STATE_ADDR + 0) == c.iirX[0] &&
+                          getWord(STATE_ADDR + 2) == c.iirX[1] &&
+                          getWord(STATE_ADDR + 4) == c.iirY[0] &&
+                          getWord(STATE_ADDR + 6) == c.iirY[1] &&
+                          ram[STATE_ADDR + 8] == c.sampledBits &&
+                          r[1] == 0;
+                if (!ok) {
+                    if (mismatches++ < 10) {
+                        printf("Mismatch: iirX[1]=%d iirY[1]=%d delayed=%d sample=%d: "
+                               "asm y=%d bits=%02x, C y=%d bits=%02x\n",
+                               init.iirX[1], init.iirY[1], d, x,
+                               getWord(STATE_ADDR + 6), ram[STATE_ADDR + 8],
+                               c.iirY[1], c.sampledBits);
+                    }
+                }
+            }
+        }
+    }
+
+    printf("AFSK_demod.S: %lu cases, %lu mismatches\n", checked, mismatches);
+    printf("Cycles including call and return: min %u, avg %.1f, max %u\n",
+           minCycles, (double)sumCycles / checked, maxCycles);
+    return mismatches ? 1 : 0;
+}
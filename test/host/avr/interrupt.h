@@ -0,0 +1,15 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+
+// Interrupt handlers become plain functions
+#define ISR(vector, ...) void vector(void); void vector(void)
+#define sei()
+#define cli()
+
+#endif
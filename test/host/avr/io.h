@@ -0,0 +1,37 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+// Just enough of the avr-libc headers to build the
+// modem code on the host for the checks in this
+// directory. The registers are plain variables that
+// each check defines with HOST_REGISTERS.
+
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+
+#define HOST_REGISTERS(R8, R16) \
+    R8(ADMUX) R8(ADCSRA) R8(ADCSRB) R8(DIDR0) R16(ADC) \
+    R8(TCCR1A) R8(TCCR1B) R8(TIFR1) R16(ICR1) R16(TCNT1) \
+    R8(PORTB) R8(DDRB) R8(PORTC) R8(DDRC) R8(PORTD) R8(DDRD)
+
+#define HOST_EXTERN8(name) extern volatile uint8_t name;
+#define HOST_EXTERN16(name) extern volatile uint16_t name;
+HOST_REGISTERS(HOST_EXTERN8, HOST_EXTERN16)
+
+enum {
+    CS10 = 0, WGM12 = 3, WGM13 = 4, ICF1 = 5,
+    REFS0 = 6, ADTS0 = 0, ADTS1 = 1, ADTS2 = 2,
+    ADPS0 = 0, ADPS1 = 1, ADPS2 = 2, ADIE = 3,
+    ADIF = 4, ADATE = 5, ADSC = 6, ADEN = 7
+};
+
+#include <avr/interrupt.h>
+
+#endif
@@ -0,0 +1,15 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+#ifndef HOST_UTIL_ATOMIC_H
+#define HOST_UTIL_ATOMIC_H
+
+// The checks are single threaded, so a block only
+// has to run once
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_BLOCK(type) for (int _once = 1; _once; _once = 0)
+
+#endif
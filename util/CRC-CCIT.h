@@ -10,14 +10,43 @@
 #define CRC_CCIT_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <avr/pgmspace.h>
+#include "device.h"
 
 #define CRC_CCIT_INIT_VAL ((uint16_t)0xFFFF)
 
-extern const uint16_t crc_ccit_table[256];
+#if CONFIG_CRC_NIBBLE_TABLE
+    // The table entry for a byte is built from two
+    // lookups in a 16 entry table, one per nibble.
+    // This uses 32 bytes of flash instead of 512.
+    extern const uint16_t crc_ccit_nibbles[16];
+
+    inline uint16_t crc_ccit_entry(uint8_t i) {
+        uint16_t crc = i;
+        crc = (crc >> 4) ^ pgm_read_word(&crc_ccit_nibbles[crc & 0x0F]);
+        return (crc >> 4) ^ pgm_read_word(&crc_ccit_nibbles[crc & 0x0F]);
+    }
+#else
+    extern const uint16_t crc_ccit_table[256];
+
+    inline uint16_t crc_ccit_entry(uint8_t i) {
+        return pgm_read_word(&crc_ccit_table[i]);
+    }
+#endif
 
 inline uint16_t update_crc_ccit(uint8_t c, uint16_t prev_crc) {
-    return (prev_crc >> 8) ^ pgm_read_word(&crc_ccit_table[(prev_crc ^ c) & 0xff]);
+    return (prev_crc >> 8) ^ crc_ccit_entry((prev_crc ^ c) & 0xff);
+}
+
+// FlexNet uses a non-reflected CRC with a table that
+// is the CRC-CCIT table XOR'ed with a constant, so we
+// can reuse the CRC-CCIT table for it.
+#define CRC_FLEX_INIT_VAL ((uint16_t)0xFFFF)
+#define CRC_FLEX_CORRECT  ((uint16_t)0x7070)
+
+inline uint16_t update_crc_flex(uint8_t c, uint16_t prev_crc) {
+    return (prev_crc << 8) ^ (crc_ccit_entry(((prev_crc >> 8) ^ c) & 0xff) ^ 0x0F87);
 }
 
 
@@ -0,0 +1,78 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+#include <stddef.h>
+#include <avr/io.h>
+#include "pool.h"
+
+#if CONFIG_FRAME_POOL_BLOCKS > 8
+    #error The frame pool supports at most 8 blocks!
+#endif
+#if CONFIG_FRAME_POOL_BLOCKS < 2
+    #error The frame pool needs at least 2 blocks!
+#endif
+
+static uint8_t arena[CONFIG_FRAME_POOL_BLOCKS][POOL_BLOCK_SIZE];
+static uint8_t used;    // One bit per block in the arena
+static uint8_t rx;      // Blocks owned by the receive path
+
+static uint8_t pool_index(const uint8_t *block) {
+    return (block - arena[0]) / POOL_BLOCK_SIZE;
+}
+
+// Number of blocks held by anything but the receive
+// path
+static uint8_t pool_held(void) {
+    uint8_t held = used & ~rx;
+    uint8_t count = 0;
+    while (held) {
+        count += held & 0x01;
+        held >>= 1;
+    }
+    return count;
+}
+
+static uint8_t *pool_take(bool forRx) {
+    for (uint8_t i = 0; i < CONFIG_FRAME_POOL_BLOCKS; i++) {
+        if (!(used & _BV(i))) {
+            used |= _BV(i);
+            if (forRx) rx |= _BV(i);
+            return arena[i];
+        }
+    }
+    return NULL;
+}
+
+// Returns a free block, or NULL if none are left that
+// can be given out without taking the last block from
+// the receive path
+uint8_t *pool_get(void) {
+    if (pool_held() >= POOL_MAX_HELD) return NULL;
+    return pool_take(false);
+}
+
+// Returns a free block for receiving from the radio,
+// or NULL if all blocks are currently owned
+uint8_t *pool_getRx(void) {
+    return pool_take(true);
+}
+
+// Takes over a block from the receive path, so it can
+// be kept after the frame in it has been handled.
+// Returns false if that would leave the receive path
+// without a block, and the block stays where it was.
+bool pool_keep(uint8_t *block) {
+    if (pool_held() >= POOL_MAX_HELD) return false;
+    rx &= ~_BV(pool_index(block));
+    return true;
+}
+
+void pool_put(uint8_t *block) {
+    if (block == NULL) return;
+    uint8_t mask = _BV(pool_index(block));
+    used &= ~mask;
+    rx &= ~mask;
+}
@@ -0,0 +1,39 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+#ifndef UTIL_POOL_H
+#define UTIL_POOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "device.h"
+#include "protocol/AX25.h"
+
+// Fixed-block pool for whole frames. The receive and
+// serial input paths take a block when a frame starts
+// and give it back when they are done with it, so the
+// RAM is shared instead of statically split between
+// them. A block is handed over by passing its pointer,
+// and the frame data is never copied between owners.
+//
+// One block is always kept for receiving from the
+// radio. Serial input, queued transmissions and frames
+// waiting to be digipeated can hold at most
+// CONFIG_FRAME_POOL_BLOCKS - 1 blocks between them, so
+// a full transmit queue can never make us drop frames
+// from the radio.
+//
+// The pool is only used from the main loop, never from
+// interrupts, so it needs no locking.
+#define POOL_BLOCK_SIZE (AX25_MAX_FRAME_LEN + 1)
+#define POOL_MAX_HELD (CONFIG_FRAME_POOL_BLOCKS - 1)
+
+uint8_t *pool_get(void);
+uint8_t *pool_getRx(void);
+bool pool_keep(uint8_t *block);
+void pool_put(uint8_t *block);
+
+#endif
@@ -0,0 +1,62 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+#include <stdbool.h>
+#include "device.h"
+
+#if CONFIG_ISR_PROFILE
+
+#include <stdio.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include "profile.h"
+
+ProfileSlot profile[PROFILE_SLOTS];
+
+static const char slotNames[PROFILE_SLOTS][8] PROGMEM = {
+    "adc_isr",
+    "dac_isr",
+    "isr",
+};
+
+void profile_reset(void) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        memset(profile, 0, sizeof(profile));
+        for (uint8_t i = 0; i < PROFILE_SLOTS; i++) {
+            profile[i].min = 0xFFFF;
+        }
+    }
+}
+
+void profile_report(const char *name) {
+    ProfileSlot snapshot[PROFILE_SLOTS];
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        memcpy(snapshot, profile, sizeof(profile));
+    }
+
+    printf_P(PSTR("--- %S ---\n"), name);
+    printf_P(PSTR("%-8s %8s %5s %5s %5s\n"), "", "calls", "min", "avg", "max");
+    for (uint8_t i = 0; i < PROFILE_SLOTS; i++) {
+        ProfileSlot *s = &snapshot[i];
+        if (s->count == 0) {
+            printf_P(PSTR("%-8S %8lu\n"), slotNames[i], 0UL);
+        } else {
+            printf_P(PSTR("%-8S %8lu %5u %5lu %5u\n"), slotNames[i], s->count, s->min, s->sum / s->count, s->max);
+        }
+    }
+
+    printf_P(PSTR("Histogram, %u cycles per bucket:\n"), 1 << PROFILE_BUCKET_SHIFT);
+    for (uint8_t i = 0; i < PROFILE_SLOTS; i++) {
+        printf_P(PSTR("%-8S"), slotNames[i]);
+        for (uint8_t b = 0; b < PROFILE_BUCKETS; b++) {
+            printf_P(PSTR(" %u"), snapshot[i].histogram[b]);
+        }
+        printf_P(PSTR("\n"));
+    }
+}
+
+#endif
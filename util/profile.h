@@ -0,0 +1,50 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+#ifndef UTIL_PROFILE_H
+#define UTIL_PROFILE_H
+
+#include <stdint.h>
+#include "device.h"
+
+// ISR cycle profiling. This is only compiled into
+// the instrumented build (CONFIG_ISR_PROFILE), where
+// the sample ISR timestamps its work with Timer 1
+// and records the results here.
+#define PROFILE_ADC 0               // AFSK_adc_isr
+#define PROFILE_DAC 1               // AFSK_dac_isr
+#define PROFILE_ISR 2               // Complete sample ISR
+#define PROFILE_SLOTS 3
+
+#define PROFILE_BUCKETS 16
+#define PROFILE_BUCKET_SHIFT 7      // 128 cycles per histogram bucket
+
+typedef struct ProfileSlot {
+    uint16_t min;
+    uint16_t max;
+    uint32_t sum;
+    uint32_t count;
+    uint16_t histogram[PROFILE_BUCKETS];
+} ProfileSlot;
+
+extern ProfileSlot profile[PROFILE_SLOTS];
+
+static inline void profile_record(uint8_t slot, uint16_t cycles) {
+    ProfileSlot *s = &profile[slot];
+    if (cycles < s->min) s->min = cycles;
+    if (cycles > s->max) s->max = cycles;
+    s->sum += cycles;
+    s->count++;
+
+    uint8_t bucket = cycles >> PROFILE_BUCKET_SHIFT;
+    if (bucket >= PROFILE_BUCKETS) bucket = PROFILE_BUCKETS - 1;
+    if (s->histogram[bucket] != 0xFFFF) s->histogram[bucket]++;
+}
+
+void profile_reset(void);
+void profile_report(const char *name);
+
+#endif
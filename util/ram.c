@@ -0,0 +1,53 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+#include <avr/io.h>
+#include "ram.h"
+
+extern uint8_t _end;            // End of .bss, set by the linker
+extern uint8_t __stack;         // Top of the stack
+extern uint8_t __heap_start;
+extern char *__brkval __attribute__((weak));
+
+// Runs in .init1, before the C runtime is set up, so
+// it must not rely on r1 being zero or on the stack.
+void ram_paint(void) __attribute__((naked, used, section(".init1")));
+void ram_paint(void) {
+    __asm volatile (
+        "    ldi r30, lo8(_end)\n"
+        "    ldi r31, hi8(_end)\n"
+        "    ldi r24, %0\n"
+        "    ldi r25, hi8(__stack)\n"
+        "    rjmp 2f\n"
+        "1:  st Z+, r24\n"
+        "2:  cpi r30, lo8(__stack)\n"
+        "    cpc r31, r25\n"
+        "    brlo 1b\n"
+        "    breq 1b\n"
+        :: "M" (RAM_CANARY)
+    );
+}
+
+// Current gap between the top of the heap and the
+// stack pointer. The firmware does not use malloc,
+// but if anything does, the heap end is taken into
+// account through the weak reference to __brkval.
+uint16_t ram_free(void) {
+    uint8_t *heapEnd = (&__brkval != 0 && __brkval != 0) ? (uint8_t *)__brkval : &__heap_start;
+    return (uint8_t *)SP - heapEnd;
+}
+
+// Smallest gap seen since startup, found by counting
+// the bytes that still hold the canary value
+uint16_t ram_minFree(void) {
+    const uint8_t *ptr = &_end;
+    uint16_t count = 0;
+    while (ptr <= &__stack && *ptr == RAM_CANARY) {
+        ptr++;
+        count++;
+    }
+    return count;
+}
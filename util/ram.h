@@ -0,0 +1,23 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+#ifndef UTIL_RAM_H
+#define UTIL_RAM_H
+
+#include <stdint.h>
+
+// Free RAM monitoring. At startup, before anything
+// else runs, all RAM between the end of the static
+// variables and the top of the stack is painted with
+// a canary value. Bytes that still hold it have never
+// been touched by the stack (or heap), so counting them
+// gives the smallest amount of free RAM seen so far.
+#define RAM_CANARY 0xC5
+
+uint16_t ram_free(void);
+uint16_t ram_minFree(void);
+
+#endif
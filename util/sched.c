@@ -0,0 +1,55 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+#include <stddef.h>
+#include "sched.h"
+
+typedef struct Timer {
+    sched_task_t task;      // NULL if the timer is free
+    ticks_t due;            // Clock value to run the task at
+} Timer;
+
+static Timer timers[CONFIG_SCHED_TIMERS];
+
+static Timer *sched_find(sched_task_t task) {
+    for (uint8_t i = 0; i < CONFIG_SCHED_TIMERS; i++) {
+        if (timers[i].task == task) return &timers[i];
+    }
+    return NULL;
+}
+
+// Returns false if all timers are in use
+bool sched_after(ticks_t delay, sched_task_t task) {
+    Timer *timer = sched_find(task);
+    if (timer == NULL) timer = sched_find(NULL);
+    if (timer == NULL) return false;
+
+    timer->due = timer_clock() + delay;
+    timer->task = task;
+    return true;
+}
+
+void sched_cancel(sched_task_t task) {
+    Timer *timer = sched_find(task);
+    if (timer != NULL) timer->task = NULL;
+}
+
+bool sched_pending(sched_task_t task) {
+    return sched_find(task) != NULL;
+}
+
+void sched_poll(void) {
+    ticks_t now = timer_clock();
+    for (uint8_t i = 0; i < CONFIG_SCHED_TIMERS; i++) {
+        sched_task_t task = timers[i].task;
+        if (task != NULL && now - timers[i].due >= 0) {
+            // The timer is freed first, so the task can
+            // schedule itself again
+            timers[i].task = NULL;
+            task();
+        }
+    }
+}
@@ -0,0 +1,32 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+#ifndef UTIL_SCHED_H
+#define UTIL_SCHED_H
+
+#include <stdbool.h>
+#include "device.h"
+#include "util/time.h"
+
+// Cooperative scheduler for deferred work. A task is a
+// function that runs to completion from the main loop
+// once its timer expires, so anything that used to be
+// a busy wait can be split into a task that reschedules
+// itself, and the modem and serial port are serviced
+// in the meantime.
+//
+// Each task has at most one pending run. Scheduling a
+// task that is already pending moves it to the new time.
+// Timers count sample clock ticks, and a delay of 0 runs
+// the task on the next pass through the main loop.
+typedef void (*sched_task_t)(void);
+
+bool sched_after(ticks_t delay, sched_task_t task);
+void sched_cancel(sched_task_t task);
+bool sched_pending(sched_task_t task);
+void sched_poll(void);
+
+#endif
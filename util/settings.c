@@ -0,0 +1,29 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+#include "settings.h"
+
+NvLayout EEMEM nv;
+
+bool settings_valid(void) {
+    return eeprom_read_byte((void*)&nv.signature) == NV_SIGNATURE &&
+           eeprom_read_byte((void*)&nv.version) == NV_VERSION &&
+           eeprom_read_word((void*)&nv.size) == sizeof(NvLayout);
+}
+
+void settings_stamp(void) {
+    if (settings_valid()) return;
+
+    eeprom_update_byte((void*)&nv.calibration.magic, 0xFF);
+    eeprom_update_byte((void*)&nv.kiss.magic, 0xFF);
+    eeprom_update_byte((void*)&nv.serial.magic, 0xFF);
+    eeprom_update_byte((void*)&nv.digi.magic, 0xFF);
+    eeprom_update_byte((void*)&nv.filter.magic, 0xFF);
+
+    eeprom_update_word((void*)&nv.size, sizeof(NvLayout));
+    eeprom_update_byte((void*)&nv.version, NV_VERSION);
+    eeprom_update_byte((void*)&nv.signature, NV_SIGNATURE);
+}
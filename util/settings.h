@@ -0,0 +1,126 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+#ifndef UTIL_SETTINGS_H
+#define UTIL_SETTINGS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/eeprom.h>
+#include "device.h"
+#include "protocol/Filter.h"
+#include "protocol/Digi.h"
+
+// EEPROM layout. Every setting the firmware stores is
+// part of the one NvLayout struct below, which is the
+// only EEMEM object in the firmware, so it always
+// starts at the first EEPROM address. Where each
+// module's block ends up no longer depends on which
+// source files are linked in, or in which order.
+//
+// The layout starts with a signature, a version and the
+// size of the whole struct. Settings stored with
+// another layout, by another firmware version or a
+// build with other CONFIG_FILTER_RULES or
+// CONFIG_DIGI_ALIASES values, are never loaded. Bump
+// NV_VERSION whenever a block below changes. Settings
+// from before this layout are converted once by
+// SimpleSerial.c, which was the only module to keep
+// any.
+//
+// Each module's block starts with its own magic byte,
+// which is only set once the block has been written,
+// so a module whose settings were never saved keeps
+// its defaults even when the other blocks are valid.
+// The KISS and SimpleSerial blocks are both always
+// present, so switching between the two protocols does
+// not move anything either.
+#define NV_SIGNATURE 0xA5
+#define NV_VERSION   0x02
+
+typedef struct NvCalibration {
+    uint8_t magic;
+    int8_t trim;
+} NvCalibration;
+
+typedef struct NvKiss {
+    uint8_t magic;
+    uint16_t preamble;
+    uint16_t tail;
+    uint16_t slotTime;
+    uint8_t p;
+    bool fullDuplex;
+    bool flowControl;
+    bool adaptiveCsma;
+    bool rxInfo;
+    bool flexnet;
+} NvKiss;
+
+typedef struct NvSimpleSerial {
+    uint8_t magic;
+    uint8_t call[6];
+    uint8_t dst[6];
+    uint8_t path1[6];
+    uint8_t path2[6];
+    uint8_t callSsid;
+    uint8_t dstSsid;
+    uint8_t path1Ssid;
+    uint8_t path2Ssid;
+    bool printSrc;
+    bool printDst;
+    bool printPath;
+    bool printData;
+    bool printInfo;
+    bool printRxInfo;
+    bool verbose;
+    bool silent;
+    uint8_t power;
+    uint8_t height;
+    uint8_t gain;
+    uint8_t directivity;
+    uint8_t symbolTable;
+    uint8_t symbol;
+    uint8_t autoAck;
+    uint16_t preamble;
+    uint16_t tail;
+} NvSimpleSerial;
+
+typedef struct NvDigi {
+    uint8_t magic;
+    DigiSettings settings;
+} NvDigi;
+
+typedef struct NvFilter {
+    uint8_t magic;
+    FilterRule rules[CONFIG_FILTER_RULES];
+} NvFilter;
+
+// The blocks with a fixed size come first, so they
+// stay put when the configurable ones change size
+typedef struct NvLayout {
+    uint8_t signature;
+    uint8_t version;
+    uint16_t size;
+    NvCalibration calibration;
+    NvKiss kiss;
+    NvSimpleSerial serial;
+    NvDigi digi;
+    NvFilter filter;
+} NvLayout;
+
+extern NvLayout EEMEM nv;
+
+// True if the EEPROM holds settings in this layout
+bool settings_valid(void);
+
+// Must be called before a module writes its block.
+// If the EEPROM holds another layout, every block is
+// marked as unwritten before the header is written,
+// so data left over from the old layout is never
+// mistaken for settings.
+void settings_stamp(void);
+
+#endif
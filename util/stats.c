@@ -0,0 +1,23 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+#include <string.h>
+#include "stats.h"
+
+Stats stats;
+
+void stats_reset(void) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        memset(&stats, 0, sizeof(stats));
+        stats.epoch = _clock;
+    }
+}
+
+void stats_snapshot(Stats *out) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        memcpy(out, &stats, sizeof(stats));
+    }
+}
@@ -0,0 +1,40 @@
+// Copyright Mark Qvist / unsigned.io
+// https://unsigned.io/microaprs
+//
+// Licensed under GPL-3.0. For full info,
+// read the LICENSE file.
+
+#ifndef UTIL_STATS_H
+#define UTIL_STATS_H
+
+#include <stdint.h>
+#include "util/time.h"
+
+// Runtime counters. Some of these are updated from
+// the ADC interrupt, so they should only be read
+// through stats_snapshot in the main loop.
+//
+// The counters are plain globals, so an update from
+// the interrupt is a single load, add and store with
+// no pointer indirection.
+typedef struct Stats {
+    uint32_t flags;         // HDLC flags seen by the demodulator
+    uint32_t frames_started;// Frames where data followed a flag
+    uint32_t rx_frames;     // Frames received with a correct CRC
+    uint32_t crc_errors;    // Received frames dropped on CRC failure
+    uint32_t rx_overruns;   // Receive FIFO overruns
+    uint32_t tx_frames;     // Frames sent to the modulator
+    uint32_t tx_ticks;      // Sample ticks spent transmitting
+    uint32_t dcd_ticks;     // Sample ticks with carrier detected
+    uint32_t idle_ticks;    // Sample ticks the CPU spent sleeping
+    uint32_t digi_dropped;  // Frames the digipeater had to leave out
+    uint16_t isr_max;       // Longest sample ISR in CPU cycles
+    ticks_t  epoch;         // Clock value when counters were reset
+} Stats;
+
+extern Stats stats;
+
+void stats_reset(void);
+void stats_snapshot(Stats *out);
+
+#endif
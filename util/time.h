@@ -16,14 +16,36 @@
 typedef int32_t ticks_t;
 typedef int32_t mtime_t;
 
-volatile ticks_t _clock;
+// Sample clock, advanced by the sample interrupt and
+// defined in AFSK.c
+extern volatile ticks_t _clock;
 
+// The clock is read without disabling interrupts, so
+// the sample interrupt is never delayed by a reader.
+// Since the interrupt can update the clock halfway
+// through a multi-byte read, the value is read twice,
+// and the read is retried if it changed in between.
+// Interrupts are a whole sample period apart, so at
+// most one retry is ever needed.
 static inline ticks_t timer_clock(void) {
     ticks_t result;
-
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    do {
         result = _clock;
-    }
+    } while (result != _clock);
+
+    return result;
+}
+
+// Low 16 bits of the clock, which is cheaper to read
+// than the whole clock. Differences between two values
+// are valid for intervals of up to 65535 ticks, which
+// is almost seven seconds.
+static inline uint16_t timer_clock16(void) {
+    const volatile uint16_t *low = (const volatile uint16_t *)&_clock;
+    uint16_t result;
+    do {
+        result = *low;
+    } while (result != *low);
 
     return result;
 }